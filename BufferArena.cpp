@@ -0,0 +1,130 @@
+#include "BufferArena.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+BufferArena::BufferArena(size_t element_size_, size_t capacity_) : element_size(element_size_), capacity(capacity_) {
+    assert(element_size > 0);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity * element_size, nullptr, GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    if (capacity != 0) free_ranges.emplace(0, capacity);
+    
+    GL_ERRORS();
+}
+
+BufferArena::~BufferArena() {
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+size_t BufferArena::allocate(size_t count) {
+    if (count == 0) return 0;
+    
+    //first fit:
+    auto fit = std::find_if(free_ranges.begin(), free_ranges.end(),
+                            [count](std::pair<size_t const, size_t> const &range) {
+                                return range.second >= count;
+                            });
+    if (fit == free_ranges.end()) {
+        grow(std::max(2 * capacity, capacity + count));
+        //the new space is (or was merged into) the last free range:
+        fit = std::prev(free_ranges.end());
+        assert(fit->second >= count);
+    }
+    
+    size_t start = fit->first;
+    size_t remaining = fit->second - count;
+    free_ranges.erase(fit);
+    if (remaining != 0) free_ranges.emplace(start + count, remaining);
+    used += count;
+    return start;
+}
+
+void BufferArena::free(size_t start, size_t count) {
+    if (count == 0) return;
+    assert(start + count <= capacity);
+    assert(used >= count);
+    used -= count;
+    
+    auto next = free_ranges.lower_bound(start);
+    assert((next == free_ranges.end() || start + count <= next->first) && "range was not allocated");
+    
+    //merge with the free range after:
+    if (next != free_ranges.end() && next->first == start + count) {
+        count += next->second;
+        next = free_ranges.erase(next);
+    }
+    //...and the one before:
+    if (next != free_ranges.begin()) {
+        auto prev = std::prev(next);
+        assert(prev->first + prev->second <= start && "range was not allocated");
+        if (prev->first + prev->second == start) {
+            prev->second += count;
+            return;
+        }
+    }
+    free_ranges.emplace(start, count);
+}
+
+size_t BufferArena::reallocate(size_t start, size_t count, size_t new_count, size_t keep) {
+    assert(keep <= count && keep <= new_count);
+    size_t new_start = allocate(new_count);
+    if (keep != 0) {
+        //(the old range is still allocated here, so the two can't overlap)
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, GLintptr(start * element_size),
+                            GLintptr(new_start * element_size), GLsizeiptr(keep * element_size));
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+    free(start, count);
+    return new_start;
+}
+
+void BufferArena::write(size_t start, void const *data, size_t count) {
+    assert(start + count <= capacity);
+    if (count == 0) return;
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, GLintptr(start * element_size), GLsizeiptr(count * element_size), data);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void BufferArena::grow(size_t new_capacity) {
+    if (new_capacity <= capacity) return;
+    
+    //park the current contents in a temporary buffer, re-specify this one, and copy them back:
+    // (all on the GPU, and 'buffer' keeps its name so VAOs don't need to change)
+    GLuint temp = 0;
+    if (capacity != 0) {
+        glGenBuffers(1, &temp);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+        glBufferData(GL_COPY_WRITE_BUFFER, capacity * element_size, nullptr, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity * element_size);
+    }
+    
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, new_capacity * element_size, nullptr, GL_DYNAMIC_DRAW);
+    
+    if (temp != 0) {
+        glBindBuffer(GL_COPY_READ_BUFFER, temp);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity * element_size);
+        glDeleteBuffers(1, &temp);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    
+    //new space goes on the end of the free list (merging with a free range that runs up to the old end):
+    size_t added_start = capacity;
+    size_t added = new_capacity - capacity;
+    capacity = new_capacity;
+    used += added; //(free() takes it back out)
+    free(added_start, added);
+    
+    GL_ERRORS();
+}
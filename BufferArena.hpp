@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * A BufferArena hands out ranges of one shared OpenGL buffer to many small users
+ *  (e.g., a vertex range per line of text), so they can share a VAO and skip buffer binds.
+ *
+ * Ranges are measured in elements of a fixed size; freed ranges are merged with their
+ *  neighbors and re-used first-fit. When no free range is big enough the buffer grows,
+ *  keeping its contents *and its name*, so VAOs that refer to it stay valid.
+ */
+
+#include "GL.hpp"
+
+#include <cstddef>
+#include <map>
+
+struct BufferArena {
+    //make an arena of 'capacity' elements of 'element_size' bytes each:
+    BufferArena(size_t element_size, size_t capacity = 4096);
+    
+    ~BufferArena();
+    
+    //the arena owns a GL buffer, so copying is not allowed:
+    BufferArena(BufferArena const &) = delete;
+    
+    BufferArena &operator=(BufferArena const &) = delete;
+    
+    //reserve 'count' elements; returns index of the first one:
+    size_t allocate(size_t count);
+    
+    //give back a range returned by allocate():
+    void free(size_t start, size_t count);
+    
+    //move a range of 'count' elements to a new range of 'new_count' elements, copying over its first 'keep' elements
+    // (on the GPU); returns the new start:
+    size_t reallocate(size_t start, size_t count, size_t new_count, size_t keep);
+    
+    //copy 'count' elements of data into the buffer starting at element 'start':
+    void write(size_t start, void const *data, size_t count);
+    
+    GLuint buffer = 0;
+    size_t element_size = 0;
+    size_t capacity = 0; //in elements
+    size_t used = 0; //elements handed out and not yet freed
+    
+    //-- internals ---
+    
+    std::map<size_t, size_t> free_ranges; //start -> count
+    
+    //make the buffer hold at least 'new_capacity' elements (existing data is kept):
+    void grow(size_t new_capacity);
+};
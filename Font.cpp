@@ -0,0 +1,171 @@
+#include "Font.hpp"
+#include "get_font_textures.hpp"
+#include "util.hpp"
+#include "gl_errors.hpp"
+
+#include <set>
+#include <stdexcept>
+
+Font::Font(std::string const &font_ttf, std::string const &font_pnct, std::string const &font_txtr) :
+        meshes(font_pnct),
+        textures(get_font_textures(font_txtr, &tex_rects, &distance_spread)),
+        glyph_program(distance_spread != 0.0f ? lit_color_texture_sdf_program : lit_color_texture_program),
+        glyph_pipeline(distance_spread != 0.0f ? lit_color_texture_sdf_program_pipeline
+                                               : lit_color_texture_program_pipeline),
+        glyph_instance_program_(distance_spread != 0.0f ? glyph_instance_sdf_program : glyph_instance_program),
+        glyph_instance_pipeline(distance_spread != 0.0f ? glyph_instance_sdf_program_pipeline
+                                                        : glyph_instance_program_pipeline),
+        meshes_for_glyph_program(meshes.make_vao_for_program(glyph_program->program)) {
+    open_face(font_ttf);
+    
+    // Look every glyph up by name once, here, so that writing text only needs glyph indices.
+    // The glyph table mirrors this for instancing, so an instance's glyph id is just its glyph index.
+    std::vector<GlyphInstanceProgram::Glyph> glyph_table((size_t) face->num_glyphs);
+    glyphs.resize((size_t) face->num_glyphs);
+    for (uint32_t index = 0; index < glyphs.size(); index++) {
+        char buf[64];
+        if (FT_Get_Glyph_Name(face, index, buf, 64)) {
+            continue;
+        }
+        std::string name(buf);
+        auto mesh = meshes.meshes.find(name);
+        auto texture = textures.find(name);
+        auto tex_rect = tex_rects.find(name);
+        if (mesh == meshes.meshes.end() || texture == textures.end() || tex_rect == tex_rects.end()) {
+            continue;
+        }
+        glyph_indices.emplace(name, index);
+        
+        Glyph &glyph = glyphs[index];
+        glyph.mesh = mesh->second;
+        glyph.texture = texture->second;
+        
+        if (glyph.mesh.count != 0) {
+            glyph.rect = glm::vec4(glyph.mesh.min.x, glyph.mesh.min.y, glyph.mesh.max.x, glyph.mesh.max.y);
+        }
+        // the glyph's spot in its atlas page (same as the texture coordinates of its mesh)
+        glyph.tex_rect = tex_rect->second;
+        
+        glyph_table[index].rect = glyph.rect;
+        glyph_table[index].tex_rect = glyph.tex_rect;
+    }
+    
+    glGenBuffers(1, &glyph_table_buffer);
+    glBindBuffer(GL_TEXTURE_BUFFER, glyph_table_buffer);
+    glBufferData(GL_TEXTURE_BUFFER, glyph_table.size() * sizeof(glyph_table[0]), glyph_table.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    
+    glGenTextures(1, &glyph_table_texture);
+    glBindTexture(GL_TEXTURE_BUFFER, glyph_table_texture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, glyph_table_buffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    
+    GL_ERRORS();
+}
+
+Font::Font(std::string const &font_ttf) :
+        glyph_program(lit_color_texture_program),
+        glyph_pipeline(lit_color_texture_program_pipeline),
+        glyph_instance_program_(glyph_instance_program),
+        glyph_instance_pipeline(glyph_instance_program_pipeline),
+        // nothing is known about any glyph until the cache rasterizes it
+        glyph_cache(std::make_unique<GlyphCache>(font_ttf)) {
+    open_face(font_ttf);
+    
+    glyphs.resize(glyph_cache->entries.size());
+    glyph_table_buffer = glyph_cache->glyph_table_buffer;
+    glyph_table_texture = glyph_cache->glyph_table_texture;
+}
+
+void Font::open_face(std::string const &font_ttf) {
+    if (FT_Init_FreeType(&library)) {
+        throw std::runtime_error("Problem initializing FreeType");
+    }
+    if (FT_New_Face(library, font_ttf.c_str(), 0, &face)) {
+        FT_Done_FreeType(library);
+        throw std::runtime_error("Problem loading font '" + font_ttf + "'");
+    }
+    if (FT_Set_Char_Size(face, PIXEL_COUNT * 64, 0, 0, 0)) {
+        FT_Done_Face(face);
+        FT_Done_FreeType(library);
+        throw std::runtime_error("Problem setting character size for '" + font_ttf + "'");
+    }
+    // (takes a reference on face, which is released along with hb_font)
+    hb_font = hb_ft_font_create_referenced(face);
+    
+    // (26.6 fixed point, like glyph positions)
+    hb_font_extents_t extents{};
+    hb_font_get_h_extents(hb_font, &extents);
+    ascender = PIXEL_SCALE * (float) extents.ascender / 64.0f;
+    descender = PIXEL_SCALE * (float) extents.descender / 64.0f;
+    line_gap = PIXEL_SCALE * (float) extents.line_gap / 64.0f;
+    
+    // (through the face's charmap, which FreeType picks as Unicode when the font has one)
+    FT_UInt index;
+    for (FT_ULong codepoint = FT_Get_First_Char(face, &index); index != 0;
+         codepoint = FT_Get_Next_Char(face, codepoint, &index)) {
+        size_t word = codepoint >> 6;
+        if (word >= coverage.size()) coverage.resize(word + 1, 0);
+        coverage[word] |= uint64_t(1) << (codepoint & 63u);
+    }
+}
+
+Font::~Font() {
+    // the cache's glyph table is its own
+    if (!glyph_cache) {
+        glDeleteTextures(1, &glyph_table_texture);
+        glDeleteBuffers(1, &glyph_table_buffer);
+    }
+    glDeleteVertexArrays(1, &meshes_for_glyph_program);
+    // many glyphs share each page, so delete each page once
+    std::set<GLuint> pages;
+    for (auto const &entry: textures) {
+        pages.insert(entry.second);
+    }
+    for (GLuint page: pages) {
+        glDeleteTextures(1, &page);
+    }
+    
+    hb_font_destroy(hb_font);
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+}
+
+void Font::shape(hb_buffer_t *buffer, hb_feature_t const *features, unsigned int feature_count) {
+    std::lock_guard<std::mutex> lock(face_mutex);
+    hb_shape(hb_font, buffer, features, feature_count);
+}
+
+uint32_t Font::glyph_index(std::string const &glyph_name) {
+    auto found = glyph_indices.find(glyph_name);
+    if (found != glyph_indices.end()) return found->second;
+    
+    // without render-glyphs' files, glyph_indices is empty, so ask the font
+    FT_UInt index = 0;
+    if (glyph_cache) {
+        std::lock_guard<std::mutex> lock(face_mutex);
+        index = FT_Get_Name_Index(face, glyph_name.c_str());
+    }
+    if (index == 0) {
+        throw std::runtime_error("Font has no glyph named '" + glyph_name + "'");
+    }
+    return index;
+}
+
+void Font::update_glyph_cache() {
+    if (!glyph_cache) return;
+    glyph_cache->update();
+    if (glyph_cache->serial == glyphs_serial) return;
+    
+    // (only on frames where something changed, so it's fine to look at every glyph)
+    for (uint32_t index = 0; index < glyphs.size(); index++) {
+        GlyphCache::Entry const &entry = glyph_cache->entries[index];
+        if (entry.changed <= glyphs_serial) continue;
+        Glyph &glyph = glyphs[index];
+        bool resident = entry.state == GlyphCache::Entry::Resident;
+        glyph.texture = resident ? glyph_cache->atlas : 0;
+        glyph.rect = entry.rect;
+        glyph.tex_rect = entry.tex_rect;
+    }
+    glyphs_serial = glyph_cache->serial;
+}
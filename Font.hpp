@@ -0,0 +1,121 @@
+#pragma once
+
+/*
+ * A Font is everything needed to write with one font: the FreeType face, a HarfBuzz font on top of it, the glyph
+ * meshes and atlas pages render-glyphs made (or a GlyphCache that rasterizes glyphs as they're needed), and the
+ * programs that draw them.
+ *
+ * Fonts are loaded once and shared by std::shared_ptr: every scene writing with the font (and every copy of those
+ * scenes) holds the same Font, so neither memory nor startup time grows with the number of scenes.
+ *
+ * Everything here belongs to the GL thread, except shape(), which any thread may call.
+ */
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include <hb.h>
+#include <hb-ft.h>
+
+#include "Scene.hpp"
+#include "Mesh.hpp"
+#include "GlyphCache.hpp"
+#include "GlyphInstanceProgram.hpp"
+#include "LitColorTextureProgram.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct Font {
+    // Pre-rendered glyphs, from render-glyphs' .pnct and .txtr files. Throws if any of the files can't be loaded.
+    Font(std::string const &font_ttf, std::string const &font_pnct, std::string const &font_txtr);
+    
+    // Glyphs rasterized as they're first written (see GlyphCache), so startup doesn't depend on the size of the font.
+    explicit Font(std::string const &font_ttf);
+    
+    ~Font();
+    
+    // owns FreeType and GL objects, so no copying (share it instead):
+    Font(Font const &) = delete;
+    
+    Font &operator=(Font const &) = delete;
+    
+    // Shapes a HarfBuzz buffer with this font. Safe to call from any thread.
+    void shape(hb_buffer_t *buffer, hb_feature_t const *features = nullptr, unsigned int feature_count = 0);
+    
+    // Picks up glyphs the glyph cache has finished (or evicted) since the last call. Cheap when nothing changed, so
+    // every scene using the font can call it every frame.
+    void update_glyph_cache();
+    
+    FT_Library library{};
+    FT_Face face{};
+    // HarfBuzz reads glyph outlines and metrics from face while shaping, and FreeType faces aren't thread safe,
+    // so shape() holds face_mutex (as does anything else that uses face off the GL thread):
+    hb_font_t *hb_font = nullptr;
+    std::mutex face_mutex;
+    
+    // Line metrics, in the same units as glyphs (PIXEL_SCALE per pixel), read once when the face is opened.
+    // Baselines are line_height() apart; descender is negative.
+    float ascender = 0.0f;
+    float descender = 0.0f;
+    float line_gap = 0.0f;
+    
+    float line_height() const { return ascender - descender + line_gap; }
+    
+    // Which codepoints the font has glyphs for, one bit per codepoint (up to the highest one it has), read once when
+    // the face is opened, so picking fonts from a fallback chain is a couple of bit tests per codepoint:
+    std::vector<uint64_t> coverage;
+    
+    bool covers(uint32_t codepoint) const {
+        size_t word = codepoint >> 6;
+        return word < coverage.size() && ((coverage[word] >> (codepoint & 63u)) & 1u) != 0;
+    }
+    
+    MeshBuffer meshes;
+    // glyph name -> (u_left, v_top, u_right, v_bottom) in its atlas page (declared first, textures fills it)
+    std::map<std::string, glm::vec4> tex_rects;
+    // 0 for coverage atlases; for distance field atlases (render-glyphs --sdf), the distance in pixels that
+    // alpha 0..1 spans (also declared before textures)
+    float distance_spread = 0.0f;
+    // glyph name -> atlas page texture; many glyphs share each page
+    std::map<std::string, GLuint> textures;
+    // programs that can read the atlas pages (the distance field variants when distance_spread != 0),
+    // and pipelines to copy for drawing with them
+    LitColorTextureProgram const *glyph_program;
+    Scene::Drawable::Pipeline glyph_pipeline;
+    GlyphInstanceProgram const *glyph_instance_program_;
+    Scene::Drawable::Pipeline glyph_instance_pipeline;
+    // meshes as glyph_program sees them (it's a vao)
+    GLuint meshes_for_glyph_program = 0;
+    
+    // Fonts made from just a .ttf rasterize glyphs as they're written instead (meshes and textures stay empty).
+    // glyphs below are kept in sync with it by update_glyph_cache().
+    std::unique_ptr<GlyphCache> glyph_cache;
+    uint32_t glyphs_serial = 0; // glyph_cache->serial as of the last sync
+    
+    // Everything needed to draw a glyph, indexed by FreeType glyph index (which is also HarfBuzz's glyph id),
+    // so text layout never has to go through glyph names:
+    struct Glyph {
+        Mesh mesh; // quad in meshes (count == 0 if the font files don't have this glyph, or with a glyph_cache)
+        GLuint texture = 0; // atlas page (0 if there's nothing to draw yet)
+        glm::vec4 rect = glm::vec4(0.0f); // quad corners (left, bottom, right, top), same as the mesh
+        glm::vec4 tex_rect = glm::vec4(0.0f); // atlas texture coordinates (left, top, right, bottom)
+    };
+    std::vector<Glyph> glyphs;
+    // glyph name -> glyph index, for looking glyphs up by name
+    std::map<std::string, uint32_t> glyph_indices;
+    // per-glyph quad rectangles and texture coordinates (also by glyph index), as a GL_RGBA32F texture buffer
+    GLuint glyph_table_buffer = 0;
+    GLuint glyph_table_texture = 0;
+    
+    // Glyph index for a glyph name; throws if the font has no such glyph.
+    uint32_t glyph_index(std::string const &glyph_name);
+    
+    //-- internals ---
+    
+    // FreeType and HarfBuzz setup shared by the constructors:
+    void open_face(std::string const &font_ttf);
+};
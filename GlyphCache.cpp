@@ -0,0 +1,295 @@
+#include "GlyphCache.hpp"
+#include "GlyphInstanceProgram.hpp"
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+GlyphCache::GlyphCache(std::string const &font_ttf) {
+    if (FT_Init_FreeType(&library)) {
+        throw std::runtime_error("Problem initializing FreeType");
+    }
+    if (FT_New_Face(library, font_ttf.c_str(), 0, &face)) {
+        FT_Done_FreeType(library);
+        throw std::runtime_error("Problem loading font '" + font_ttf + "'");
+    }
+    if (FT_Set_Char_Size(face, RasterSize * 64, 0, 0, 0)) {
+        FT_Done_Face(face);
+        FT_Done_FreeType(library);
+        throw std::runtime_error("Problem setting character size for '" + font_ttf + "'");
+    }
+    entries.resize((size_t) face->num_glyphs);
+    
+    { // atlas starts out empty (the pixels need zeroing, since mipmaps read the space between glyphs)
+        std::vector<uint8_t> zeros(AtlasSize * AtlasSize, 0);
+        glGenTextures(1, &atlas);
+        glBindTexture(GL_TEXTURE_2D, atlas);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, AtlasSize, AtlasSize, 0, GL_RED, GL_UNSIGNED_BYTE, zeros.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        // same setup as get_font_textures
+        GLint swizzle[4] = {GL_ZERO, GL_ZERO, GL_ZERO, GL_RED};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    
+    { // every glyph starts out as an empty quad
+        std::vector<GlyphInstanceProgram::Glyph> glyph_table(entries.size(), GlyphInstanceProgram::Glyph{
+                glm::vec4(0.0f), glm::vec4(0.0f)
+        });
+        glGenBuffers(1, &glyph_table_buffer);
+        glBindBuffer(GL_TEXTURE_BUFFER, glyph_table_buffer);
+        glBufferData(GL_TEXTURE_BUFFER, glyph_table.size() * sizeof(glyph_table[0]), glyph_table.data(),
+                     GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        
+        glGenTextures(1, &glyph_table_texture);
+        glBindTexture(GL_TEXTURE_BUFFER, glyph_table_texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, glyph_table_buffer);
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+    }
+    
+    GL_ERRORS();
+    
+    worker = std::thread(&GlyphCache::work, this);
+}
+
+GlyphCache::~GlyphCache() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wake.notify_one();
+    worker.join();
+    
+    glDeleteTextures(1, &glyph_table_texture);
+    glDeleteBuffers(1, &glyph_table_buffer);
+    glDeleteTextures(1, &atlas);
+    
+    FT_Done_Face(face);
+    FT_Done_FreeType(library);
+}
+
+void GlyphCache::acquire(uint32_t glyph_index) {
+    assert(glyph_index < entries.size());
+    Entry &entry = entries[glyph_index];
+    entry.uses++;
+    entry.last_used = ++use_clock;
+    if (entry.state != Entry::Absent) return;
+    
+    entry.state = Entry::Requested;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        requests.push_back(glyph_index);
+    }
+    wake.notify_one();
+}
+
+void GlyphCache::release(uint32_t glyph_index) {
+    assert(glyph_index < entries.size());
+    Entry &entry = entries[glyph_index];
+    assert(entry.uses > 0);
+    entry.uses--;
+    entry.last_used = ++use_clock;
+    if (entry.uses == 0) released = true;
+}
+
+void GlyphCache::set_entry(uint32_t glyph_index, Entry::State state, glm::vec4 const &rect,
+                           glm::vec4 const &tex_rect) {
+    Entry &entry = entries[glyph_index];
+    entry.state = state;
+    entry.rect = rect;
+    entry.tex_rect = tex_rect;
+    entry.changed = ++serial;
+    
+    GlyphInstanceProgram::Glyph table_glyph{rect, tex_rect};
+    glBindBuffer(GL_TEXTURE_BUFFER, glyph_table_buffer);
+    glBufferSubData(GL_TEXTURE_BUFFER, glyph_index * sizeof(table_glyph), sizeof(table_glyph), &table_glyph);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void GlyphCache::update() {
+    std::vector<Bitmap> bitmaps;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        bitmaps.swap(finished);
+    }
+    stats.rasterized += (uint32_t) bitmaps.size();
+    
+    // glyphs that didn't fit last time only can now if something was released (eviction needs unused glyphs):
+    if (released && !pending.empty()) {
+        for (Bitmap &bitmap: pending) {
+            Entry &entry = entries[bitmap.glyph_index];
+            if (entry.uses == 0) {
+                // nothing wants it anymore, so forget it (the table entry is still empty, so nothing changed)
+                entry.state = Entry::Absent;
+            } else {
+                bitmaps.emplace_back(std::move(bitmap));
+            }
+        }
+        pending.clear();
+    }
+    released = false;
+    if (bitmaps.empty()) return;
+    
+    bool uploaded = false;
+    glBindTexture(GL_TEXTURE_2D, atlas);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (Bitmap &bitmap: bitmaps) {
+        assert(entries[bitmap.glyph_index].state == Entry::Requested);
+        if (place(bitmap)) {
+            uploaded = uploaded || (bitmap.width != 0 && bitmap.height != 0);
+            continue;
+        }
+        // everything in the atlas is in use; hang on to the pixels until a release() makes room
+        if (stats.dropped == 0) {
+            std::cerr << "Warning: glyph atlas is full of glyphs in use; some glyphs will wait for room.\n";
+        }
+        stats.dropped++;
+        pending.emplace_back(std::move(bitmap));
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    // one mipmap rebuild for the whole batch
+    if (uploaded) glGenerateMipmap(GL_TEXTURE_2D);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    
+    GL_ERRORS();
+}
+
+bool GlyphCache::place(Bitmap const &bitmap) {
+    // same rectangle render-glyphs makes, in ems (whatever size it's rasterized at)
+    glm::vec4 rect = glm::vec4((float) bitmap.left,
+                               (float) (bitmap.top - (int32_t) bitmap.height),
+                               (float) (bitmap.left + (int32_t) bitmap.width),
+                               (float) bitmap.top) / (float) RasterSize;
+    if (bitmap.width == 0 || bitmap.height == 0) {
+        set_entry(bitmap.glyph_index, Entry::Resident, glm::vec4(0.0f), glm::vec4(0.0f));
+        return true;
+    }
+    
+    uint32_t s, x;
+    if (!allocate(bitmap.width, bitmap.height, &s, &x)) return false;
+    Shelf &shelf = shelves[s];
+    shelf.glyphs.push_back(bitmap.glyph_index);
+    
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (GLint) x, (GLint) shelf.y, (GLsizei) bitmap.width,
+                    (GLsizei) bitmap.height, GL_RED, GL_UNSIGNED_BYTE, bitmap.pixels.data());
+    
+    glm::vec4 tex_rect = glm::vec4((float) x, (float) shelf.y,
+                                   (float) (x + bitmap.width), (float) (shelf.y + bitmap.height))
+                         / (float) AtlasSize;
+    set_entry(bitmap.glyph_index, Entry::Resident, rect, tex_rect);
+    return true;
+}
+
+bool GlyphCache::allocate(uint32_t width, uint32_t height, uint32_t *shelf_, uint32_t *x_) {
+    if (width + 2 * AtlasPadding > AtlasSize || height + 2 * AtlasPadding > AtlasSize) return false;
+    uint32_t shelf_height = (height + ShelfStep - 1) / ShelfStep * ShelfStep;
+    
+    auto take = [&](uint32_t s) {
+        *shelf_ = s;
+        *x_ = shelves[s].x;
+        shelves[s].x += width + AtlasPadding;
+    };
+    
+    // a shelf of the same height with room left:
+    for (uint32_t s = 0; s < shelves.size(); s++) {
+        if (shelves[s].height == shelf_height && shelves[s].x + width + AtlasPadding <= AtlasSize) {
+            take(s);
+            return true;
+        }
+    }
+    
+    // a new shelf:
+    if (shelves_end + shelf_height + AtlasPadding <= AtlasSize) {
+        Shelf shelf;
+        shelf.y = shelves_end;
+        shelf.height = shelf_height;
+        shelves.push_back(shelf);
+        shelves_end += shelf_height + AtlasPadding;
+        take((uint32_t) shelves.size() - 1);
+        return true;
+    }
+    
+    // the least recently used shelf that's tall enough and has nothing in use (a shelf is as recent as its most
+    // recently used glyph):
+    uint32_t best = -1U;
+    uint32_t best_used = 0;
+    for (uint32_t s = 0; s < shelves.size(); s++) {
+        Shelf const &shelf = shelves[s];
+        if (shelf.height < shelf_height) continue;
+        bool in_use = false;
+        uint32_t used = 0;
+        for (uint32_t glyph_index: shelf.glyphs) {
+            in_use = in_use || entries[glyph_index].uses != 0;
+            used = std::max(used, entries[glyph_index].last_used);
+        }
+        if (in_use) continue;
+        // (prefer shelves that fit snugly when they're equally old)
+        if (best == -1U || used < best_used || (used == best_used && shelf.height < shelves[best].height)) {
+            best = s;
+            best_used = used;
+        }
+    }
+    if (best == -1U) return false;
+    
+    evict(best);
+    take(best);
+    return true;
+}
+
+void GlyphCache::evict(uint32_t s) {
+    Shelf &shelf = shelves[s];
+    for (uint32_t glyph_index: shelf.glyphs) {
+        assert(entries[glyph_index].uses == 0);
+        set_entry(glyph_index, Entry::Absent, glm::vec4(0.0f), glm::vec4(0.0f));
+        stats.evicted++;
+    }
+    shelf.glyphs.clear();
+    shelf.x = AtlasPadding;
+    
+    // clear the old pixels so they don't bleed into the new glyphs' padding
+    std::vector<uint8_t> zeros(AtlasSize * shelf.height, 0);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, (GLint) shelf.y, AtlasSize, (GLsizei) shelf.height,
+                    GL_RED, GL_UNSIGNED_BYTE, zeros.data());
+}
+
+void GlyphCache::work() {
+    while (true) {
+        uint32_t glyph_index;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return quit || !requests.empty(); });
+            if (quit) return;
+            glyph_index = requests.front();
+            requests.pop_front();
+        }
+        
+        // same rendering as render-glyphs (FT_LOAD_RENDER gives one byte of coverage per pixel)
+        Bitmap bitmap;
+        bitmap.glyph_index = glyph_index;
+        if (FT_Load_Glyph(face, glyph_index, FT_LOAD_RENDER)) {
+            std::cerr << "Warning: problem rendering glyph " << glyph_index << "\n";
+        } else {
+            FT_Bitmap const &ft_bitmap = face->glyph->bitmap;
+            bitmap.left = face->glyph->bitmap_left;
+            bitmap.top = face->glyph->bitmap_top;
+            bitmap.width = ft_bitmap.width;
+            bitmap.height = ft_bitmap.rows;
+            bitmap.pixels.reserve(bitmap.width * bitmap.height);
+            unsigned char const *row = ft_bitmap.buffer;
+            for (uint32_t r = 0; r < bitmap.height; r++, row += ft_bitmap.pitch) {
+                bitmap.pixels.insert(bitmap.pixels.end(), row, row + bitmap.width);
+            }
+        }
+        
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(std::move(bitmap));
+    }
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+/*
+ * A GlyphCache rasterizes glyphs while the game runs, instead of render-glyphs doing every glyph in the font ahead of
+ * time. Glyphs are rendered with FreeType on a worker thread the first time something asks for them, then packed into
+ * one atlas texture on the GL thread (in update()). When the atlas fills up, the least recently used shelf of glyphs
+ * that nothing is drawing gets evicted to make room; glyphs that still don't fit wait (rasterized) until a release()
+ * frees some.
+ *
+ * So startup only costs opening the font, no matter how many glyphs it has.
+ *
+ * The cache also keeps a glyph table in WriteGlyphScene's instancing layout (GlyphInstanceProgram::Glyph, by glyph
+ * index), where glyphs that aren't in the atlas are empty quads: instanced glyphs just show up once they're ready.
+ */
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "GL.hpp"
+
+#include <glm/glm.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct GlyphCache {
+    // Opens its own copy of the font for the worker thread (FreeType faces can't be shared between threads),
+    // at RasterSize. Throws if the font can't be loaded.
+    explicit GlyphCache(std::string const &font_ttf);
+    
+    ~GlyphCache();
+    
+    // owns a thread and GL objects, so no copying (share it instead):
+    GlyphCache(GlyphCache const &) = delete;
+    
+    GlyphCache &operator=(GlyphCache const &) = delete;
+    
+    // What the cache knows about a glyph, by glyph index:
+    struct Entry {
+        enum State : uint8_t {
+            Absent, // not rasterized (or evicted)
+            Requested, // waiting on the worker (or for room in the atlas)
+            Resident // in the atlas (glyphs with no pixels, like spaces, are resident without taking any space)
+        } state = Absent;
+        glm::vec4 rect = glm::vec4(0.0f); // quad corners (left, bottom, right, top), same units as render-glyphs
+        glm::vec4 tex_rect = glm::vec4(0.0f); // atlas texture coordinates (left, top, right, bottom)
+        uint32_t uses = 0; // how many things are drawing the glyph; glyphs in use are never evicted
+        uint32_t last_used = 0; // use_clock when the glyph was last acquired or released
+        uint32_t changed = 0; // serial of the last change to this entry
+    };
+    std::vector<Entry> entries;
+    
+    // Say that something is drawing a glyph (or has stopped). Glyphs that aren't resident get requested from the
+    // worker.
+    void acquire(uint32_t glyph_index);
+    
+    void release(uint32_t glyph_index);
+    
+    // Packs and uploads whatever the worker has finished since the last call. Call once a frame, on the GL thread.
+    void update();
+    
+    // bumped every time an entry changes, so users can tell when to look for changed entries:
+    uint32_t serial = 0;
+    
+    GLuint atlas = 0; // GL_R8, swizzled to (0, 0, 0, coverage) like get_font_textures' pages
+    GLuint glyph_table_buffer = 0;
+    GLuint glyph_table_texture = 0; // GL_RGBA32F texture buffer over glyph_table_buffer
+    
+    // counts since construction:
+    struct Stats {
+        uint32_t rasterized = 0; // glyphs the worker rendered (counted as update() picks them up)
+        uint32_t evicted = 0; // glyphs evicted to make room
+        uint32_t dropped = 0; // times a glyph didn't fit, even after evicting (it waits in pending for room)
+    } stats;
+    
+    //-- internals ---
+    
+    // Pixels per em to rasterize at. Smaller than render-glyphs' PIXEL_COUNT, so a few hundred glyphs fit in the
+    // atlas instead of about a hundred; quads are the same size in the scene either way.
+    static constexpr uint32_t RasterSize = 64;
+    static constexpr uint32_t AtlasSize = 2048;
+    static constexpr uint32_t AtlasPadding = 4; // same as render-glyphs, for the same mipmap reason
+    static constexpr uint32_t ShelfStep = 16; // shelf heights are rounded up to this, so evicted shelves get re-used
+    
+    // Glyphs are packed left to right on shelves; eviction empties a whole shelf at a time.
+    struct Shelf {
+        uint32_t y = 0, height = 0;
+        uint32_t x = AtlasPadding; // where the next glyph goes
+        std::vector<uint32_t> glyphs;
+    };
+    std::vector<Shelf> shelves;
+    uint32_t shelves_end = AtlasPadding; // top of the atlas space no shelf has claimed yet
+    uint32_t use_clock = 0;
+    
+    // finds space for a width x height bitmap, evicting if needed; returns false if there isn't any:
+    bool allocate(uint32_t width, uint32_t height, uint32_t *shelf_, uint32_t *x_);
+    
+    void evict(uint32_t shelf);
+    
+    void set_entry(uint32_t glyph_index, Entry::State state, glm::vec4 const &rect, glm::vec4 const &tex_rect);
+    
+    // A rendered glyph, handed from the worker to update():
+    struct Bitmap {
+        uint32_t glyph_index = 0;
+        int32_t left = 0, top = 0; // where the top left corner goes, in pixels from the pen position
+        uint32_t width = 0, height = 0;
+        std::vector<uint8_t> pixels; // row by row, top-down
+    };
+    
+    // puts a bitmap in the atlas and its entry in the table; returns false if there's no room:
+    bool place(Bitmap const &bitmap);
+    
+    // rendered glyphs that didn't fit; update() tries them again once a release() could have made room
+    // (their entries stay Requested, so nothing re-requests them and nothing needs redoing until they're in):
+    std::vector<Bitmap> pending;
+    bool released = false; // some glyph's uses dropped to zero since update() last tried pending
+    
+    // shared with the worker (guarded by mutex):
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<uint32_t> requests;
+    std::vector<Bitmap> finished;
+    bool quit = false;
+    
+    // only touched by the worker once it starts:
+    FT_Library library{};
+    FT_Face face{};
+    std::thread worker;
+    
+    void work();
+};
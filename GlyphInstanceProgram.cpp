@@ -0,0 +1,137 @@
+#include "GlyphInstanceProgram.hpp"
+#include "LitColorTextureProgram.hpp"
+
+#include "gl_compile_program.hpp"
+#include "gl_errors.hpp"
+
+#include <cstddef>
+
+Scene::Drawable::Pipeline glyph_instance_program_pipeline;
+Scene::Drawable::Pipeline glyph_instance_sdf_program_pipeline;
+
+Load<GlyphInstanceProgram> glyph_instance_program(LoadTagEarly, []() -> GlyphInstanceProgram const * {
+    auto *ret = new GlyphInstanceProgram();
+    
+    //----- build the pipeline template -----
+    glyph_instance_program_pipeline.program = ret->program;
+    
+    //matrices and light list come from the Object block, which Scene::draw fills in:
+    glyph_instance_program_pipeline.object_block = true;
+    
+    //every instance is one six-vertex quad:
+    glyph_instance_program_pipeline.type = GL_TRIANGLES;
+    glyph_instance_program_pipeline.start = 0;
+    glyph_instance_program_pipeline.count = 6;
+    glyph_instance_program_pipeline.instances = 0;
+    
+    glyph_instance_program_pipeline.textures[1].target = GL_TEXTURE_BUFFER;
+    
+    return ret;
+});
+
+Load<GlyphInstanceProgram> glyph_instance_sdf_program(LoadTagEarly, []() -> GlyphInstanceProgram const * {
+    auto *ret = new GlyphInstanceProgram(true);
+    
+    //same as above (the glyph_instance_program loader runs first, being earlier in this file):
+    glyph_instance_sdf_program_pipeline = glyph_instance_program_pipeline;
+    glyph_instance_sdf_program_pipeline.program = ret->program;
+    
+    return ret;
+});
+
+GlyphInstanceProgram::GlyphInstanceProgram(bool distance_field) {
+    //Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
+    program = gl_compile_program(
+            //vertex shader:
+            "#version 330\n"
+            "layout(std140) uniform Object {\n"
+            "	mat4 OBJECT_TO_CLIP;\n"
+            "	mat4x3 OBJECT_TO_LIGHT;\n"
+            "	mat3 NORMAL_TO_LIGHT;\n"
+            "	ivec4 LIGHT_INDEX[2];\n"
+            "	int LIGHT_COUNT;\n"
+            "};\n"
+            "uniform samplerBuffer GLYPHS;\n"
+            "in mat4x3 Instance;\n"
+            "in uint Glyph;\n"
+            "in vec4 Color;\n"
+            "out vec3 position;\n"
+            "out vec3 normal;\n"
+            "out vec4 color;\n"
+            "out vec2 texCoord;\n"
+            //quad corners in the same order render-glyphs writes them (x: 0 left, 1 right; y: 0 bottom, 1 top):
+            "const vec2 CORNERS[6] = vec2[6](vec2(0,1), vec2(1,1), vec2(1,0), vec2(0,1), vec2(1,0), vec2(0,0));\n"
+            "void main() {\n"
+            "	vec2 corner = CORNERS[gl_VertexID];\n"
+            "	vec4 rect = texelFetch(GLYPHS, int(2u * Glyph));\n"
+            "	vec4 tex_rect = texelFetch(GLYPHS, int(2u * Glyph + 1u));\n"
+            "	vec4 Position = vec4(Instance * vec4(mix(rect.xy, rect.zw, corner), 0.0, 1.0), 1.0);\n"
+            "	gl_Position = OBJECT_TO_CLIP * Position;\n"
+            "	position = OBJECT_TO_LIGHT * Position;\n"
+            //glyphs lie in their local xy plane, so the (inverse-transpose) normal is along the cross product of the x and y axes:
+            "	normal = NORMAL_TO_LIGHT * cross(Instance[0], Instance[1]);\n"
+            "	color = Color;\n"
+            "	texCoord = vec2(mix(tex_rect.x, tex_rect.z, corner.x), mix(tex_rect.w, tex_rect.y, corner.y));\n"
+            "}\n",
+            //fragment shader:
+            lit_color_texture_fragment_source(distance_field)
+    );
+    //As you can see above, adjacent strings in C/C++ are concatenated.
+    // this is very useful for writing long shader programs inline.
+    
+    //look up the locations of vertex attributes:
+    Instance_mat4x3 = glGetAttribLocation(program, "Instance");
+    Glyph_uint = glGetAttribLocation(program, "Glyph");
+    Color_vec4 = glGetAttribLocation(program, "Color");
+    
+    //the Object and Lights blocks always read from Scene's uniform buffer bindings:
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Object"), Scene::ObjectBinding);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), Scene::LightsBinding);
+    
+    GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
+    GLuint GLYPHS_samplerBuffer = glGetUniformLocation(program, "GLYPHS");
+    
+    glUseProgram(program); //bind program -- glUniform* calls refer to this program now
+    
+    glUniform1i(TEX_sampler2D, 0); //set TEX to sample from GL_TEXTURE0
+    glUniform1i(GLYPHS_samplerBuffer, 1); //set GLYPHS to sample from GL_TEXTURE1
+    
+    glUseProgram(0); //unbind program -- glUniform* calls refer to ??? now
+}
+
+GlyphInstanceProgram::~GlyphInstanceProgram() {
+    glDeleteProgram(program);
+    program = 0;
+}
+
+GLuint GlyphInstanceProgram::make_vao(GLuint buffer) const {
+    GLuint vao = 0;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    
+    //a mat4x3 attribute is four vec3 attributes in consecutive locations:
+    for (GLuint c = 0; c < 4; ++c) {
+        glVertexAttribPointer(Instance_mat4x3 + c, 3, GL_FLOAT, GL_FALSE, sizeof(Instance),
+                              (GLbyte *) nullptr + offsetof(Instance, to_object) + c * sizeof(glm::vec3));
+        glEnableVertexAttribArray(Instance_mat4x3 + c);
+        glVertexAttribDivisor(Instance_mat4x3 + c, 1);
+    }
+    
+    glVertexAttribIPointer(Glyph_uint, 1, GL_UNSIGNED_INT, sizeof(Instance),
+                           (GLbyte *) nullptr + offsetof(Instance, glyph));
+    glEnableVertexAttribArray(Glyph_uint);
+    glVertexAttribDivisor(Glyph_uint, 1);
+    
+    glVertexAttribPointer(Color_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Instance),
+                          (GLbyte *) nullptr + offsetof(Instance, color));
+    glEnableVertexAttribArray(Color_vec4);
+    glVertexAttribDivisor(Color_vec4, 1);
+    
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+    
+    GL_ERRORS();
+    
+    return vao;
+}
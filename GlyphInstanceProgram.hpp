@@ -0,0 +1,61 @@
+#pragma once
+
+#include "GL.hpp"
+#include "Load.hpp"
+#include "Scene.hpp"
+
+#include <glm/glm.hpp>
+
+//Shader program that draws instanced glyph quads, lit the same way as LitColorTextureProgram.
+// Each instance is one glyph; the quad's corners and texture coordinates are looked up by glyph id
+// in the GLYPHS texture buffer, so a single glDrawArraysInstanced( GL_TRIANGLES, 0, 6, n ) draws n glyphs.
+struct GlyphInstanceProgram {
+    //distance_field: glyph textures are signed distance fields (see LitColorTextureProgram)
+    explicit GlyphInstanceProgram(bool distance_field = false);
+    
+    ~GlyphInstanceProgram();
+    
+    GLuint program = 0;
+    
+    //Attribute (per-instance variable) locations:
+    GLuint Instance_mat4x3 = -1U; //glyph to object matrix (occupies four locations, one per column)
+    GLuint Glyph_uint = -1U; //glyph id (index into GLYPHS)
+    GLuint Color_vec4 = -1U;
+    
+    //Uniform blocks (filled in by Scene::draw):
+    //Object - per-drawable matrices and light list (see Scene::ObjectData), at Scene::ObjectBinding
+    //Lights - all lights in the scene (see Scene::LightData), at Scene::LightsBinding
+    
+    //Per-instance data, in the layout make_vao() expects:
+    struct Instance {
+        glm::mat4x3 to_object;
+        uint32_t glyph;
+        glm::u8vec4 color;
+    };
+    static_assert(sizeof(Instance) == 4 * 3 * 4 + 4 + 4, "Instance is packed.");
+    
+    //Per-glyph data, two texels per glyph in GLYPHS:
+    struct Glyph {
+        glm::vec4 rect; //(left, bottom, right, top) of the quad, in glyph space
+        glm::vec4 tex_rect; //texture coordinates at (left, top) and (right, bottom)
+    };
+    static_assert(sizeof(Glyph) == 2 * 4 * 4, "Glyph is packed.");
+    
+    //build a vertex array object that reads Instance structures from 'buffer', one per instance:
+    GLuint make_vao(GLuint buffer) const;
+    
+    //Textures:
+    //TEXTURE0 - glyph texture, accessed through tex_rect
+    //TEXTURE1 - GLYPHS texture buffer (GL_RGBA32F)
+};
+
+extern Load<GlyphInstanceProgram> glyph_instance_program;
+
+//Same, but with distance_field set:
+extern Load<GlyphInstanceProgram> glyph_instance_sdf_program;
+
+//For convenient scene-graph setup, copy this object:
+// NOTE: instances, vao, and textures still need to be filled in.
+extern Scene::Drawable::Pipeline glyph_instance_program_pipeline;
+
+extern Scene::Drawable::Pipeline glyph_instance_sdf_program_pipeline;
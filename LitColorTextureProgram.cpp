@@ -4,6 +4,7 @@
 #include "gl_errors.hpp"
 
 Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+Scene::Drawable::Pipeline lit_color_texture_sdf_program_pipeline;
 
 Load<LitColorTextureProgram> lit_color_texture_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
     auto *ret = new LitColorTextureProgram();
@@ -11,17 +12,8 @@ Load<LitColorTextureProgram> lit_color_texture_program(LoadTagEarly, []() -> Lit
     //----- build the pipeline template -----
     lit_color_texture_program_pipeline.program = ret->program;
     
-    lit_color_texture_program_pipeline.OBJECT_TO_CLIP_mat4 = ret->OBJECT_TO_CLIP_mat4;
-    lit_color_texture_program_pipeline.OBJECT_TO_LIGHT_mat4x3 = ret->OBJECT_TO_LIGHT_mat4x3;
-    lit_color_texture_program_pipeline.NORMAL_TO_LIGHT_mat3 = ret->NORMAL_TO_LIGHT_mat3;
-    
-    /* This will be used later if/when we build a light loop into the Scene:
-    lit_color_texture_program_pipeline.LIGHT_TYPE_int = ret->LIGHT_TYPE_int;
-    lit_color_texture_program_pipeline.LIGHT_LOCATION_vec3 = ret->LIGHT_LOCATION_vec3;
-    lit_color_texture_program_pipeline.LIGHT_DIRECTION_vec3 = ret->LIGHT_DIRECTION_vec3;
-    lit_color_texture_program_pipeline.LIGHT_ENERGY_vec3 = ret->LIGHT_ENERGY_vec3;
-    lit_color_texture_program_pipeline.LIGHT_CUTOFF_float = ret->LIGHT_CUTOFF_float;
-    */
+    //matrices and light list come from the Object block, which Scene::draw fills in:
+    lit_color_texture_program_pipeline.object_block = true;
     
     //make a 1-pixel white texture to bind by default:
     GLuint tex;
@@ -43,14 +35,103 @@ Load<LitColorTextureProgram> lit_color_texture_program(LoadTagEarly, []() -> Lit
     return ret;
 });
 
-LitColorTextureProgram::LitColorTextureProgram() {
+Load<LitColorTextureProgram> lit_color_texture_sdf_program(LoadTagEarly, []() -> LitColorTextureProgram const * {
+    auto *ret = new LitColorTextureProgram(true);
+    
+    //same as above (the lit_color_texture_program loader runs first, being earlier in this file):
+    lit_color_texture_sdf_program_pipeline = lit_color_texture_program_pipeline;
+    lit_color_texture_sdf_program_pipeline.program = ret->program;
+    
+    return ret;
+});
+
+//Fragment shader shared by programs that light the same way as LitColorTextureProgram:
+// (evaluates the LIGHT_COUNT lights listed in LIGHT_INDEX; see Scene::ObjectData and Scene::LightData for block layouts)
+// (compile with DISTANCE_FIELD defined, e.g. with lit_color_texture_fragment_source(true), for distance field textures)
+static_assert(Scene::MaxLights == 64 && Scene::MaxDrawableLights == 8, "array sizes in shader must match Scene");
+char const *lit_color_texture_fragment_shader =
+        "#version 330\n"
+        "uniform sampler2D TEX;\n"
+        "struct Light {\n"
+        "	vec4 location_type;\n"
+        "	vec4 direction_cutoff;\n"
+        "	vec4 energy;\n"
+        "};\n"
+        "layout(std140) uniform Lights {\n"
+        "	Light LIGHTS[64];\n"
+        "};\n"
+        "layout(std140) uniform Object {\n"
+        "	mat4 OBJECT_TO_CLIP;\n"
+        "	mat4x3 OBJECT_TO_LIGHT;\n"
+        "	mat3 NORMAL_TO_LIGHT;\n"
+        "	ivec4 LIGHT_INDEX[2];\n"
+        "	int LIGHT_COUNT;\n"
+        "};\n"
+        "in vec3 position;\n"
+        "in vec3 normal;\n"
+        "in vec4 color;\n"
+        "in vec2 texCoord;\n"
+        "out vec4 fragColor;\n"
+        "void main() {\n"
+        "	vec3 n = normalize(normal);\n"
+        "	vec3 e = vec3(0.0);\n"
+        "	for (int i = 0; i < LIGHT_COUNT; ++i) {\n"
+        "		Light light = LIGHTS[LIGHT_INDEX[i / 4][i % 4]];\n"
+        "		int LIGHT_TYPE = int(light.location_type.w);\n"
+        "		vec3 LIGHT_LOCATION = light.location_type.xyz;\n"
+        "		vec3 LIGHT_DIRECTION = light.direction_cutoff.xyz;\n"
+        "		float LIGHT_CUTOFF = light.direction_cutoff.w;\n"
+        "		vec3 LIGHT_ENERGY = light.energy.rgb;\n"
+        "		if (LIGHT_TYPE == 0) { //point light \n"
+        "			vec3 l = (LIGHT_LOCATION - position);\n"
+        "			float dis2 = dot(l,l);\n"
+        "			l = normalize(l);\n"
+        "			float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+        "			e += nl * LIGHT_ENERGY;\n"
+        "		} else if (LIGHT_TYPE == 1) { //hemi light \n"
+        "			e += (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
+        "		} else if (LIGHT_TYPE == 2) { //spot light \n"
+        "			vec3 l = (LIGHT_LOCATION - position);\n"
+        "			float dis2 = dot(l,l);\n"
+        "			l = normalize(l);\n"
+        "			float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
+        "			float c = dot(l,-LIGHT_DIRECTION);\n"
+        "			nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
+        "			e += nl * LIGHT_ENERGY;\n"
+        "		} else { //(LIGHT_TYPE == 3) //directional light \n"
+        "			e += max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
+        "		}\n"
+        "	}\n"
+        "#ifdef DISTANCE_FIELD\n"
+        //alpha is distance to the edge (0.5 on it), so turn it into coverage over about a pixel of screen:
+        "	vec4 texel = texture(TEX, texCoord);\n"
+        "	float w = max(0.7 * fwidth(texel.a), 1e-4);\n"
+        "	texel.a = smoothstep(0.5 - w, 0.5 + w, texel.a);\n"
+        "	vec4 albedo = texel * color;\n"
+        "#else\n"
+        "	vec4 albedo = texture(TEX, texCoord) * color;\n"
+        "#endif\n"
+        "	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
+        "}\n";
+
+std::string lit_color_texture_fragment_source(bool distance_field) {
+    std::string source = lit_color_texture_fragment_shader;
+    if (distance_field) source.insert(source.find('\n') + 1, "#define DISTANCE_FIELD\n"); //(after #version)
+    return source;
+}
+
+LitColorTextureProgram::LitColorTextureProgram(bool distance_field) {
     //Compile vertex and fragment shaders using the convenient 'gl_compile_program' helper function:
     program = gl_compile_program(
             //vertex shader:
             "#version 330\n"
-            "uniform mat4 OBJECT_TO_CLIP;\n"
-            "uniform mat4x3 OBJECT_TO_LIGHT;\n"
-            "uniform mat3 NORMAL_TO_LIGHT;\n"
+            "layout(std140) uniform Object {\n"
+            "	mat4 OBJECT_TO_CLIP;\n"
+            "	mat4x3 OBJECT_TO_LIGHT;\n"
+            "	mat3 NORMAL_TO_LIGHT;\n"
+            "	ivec4 LIGHT_INDEX[2];\n"
+            "	int LIGHT_COUNT;\n"
+            "};\n"
             "in vec4 Position;\n"
             "in vec3 Normal;\n"
             "in vec4 Color;\n"
@@ -67,43 +148,7 @@ LitColorTextureProgram::LitColorTextureProgram() {
             "	texCoord = TexCoord;\n"
             "}\n",
             //fragment shader:
-            "#version 330\n"
-            "uniform sampler2D TEX;\n"
-            "uniform int LIGHT_TYPE;\n"
-            "uniform vec3 LIGHT_LOCATION;\n"
-            "uniform vec3 LIGHT_DIRECTION;\n"
-            "uniform vec3 LIGHT_ENERGY;\n"
-            "uniform float LIGHT_CUTOFF;\n"
-            "in vec3 position;\n"
-            "in vec3 normal;\n"
-            "in vec4 color;\n"
-            "in vec2 texCoord;\n"
-            "out vec4 fragColor;\n"
-            "void main() {\n"
-            "	vec3 n = normalize(normal);\n"
-            "	vec3 e;\n"
-            "	if (LIGHT_TYPE == 0) { //point light \n"
-            "		vec3 l = (LIGHT_LOCATION - position);\n"
-            "		float dis2 = dot(l,l);\n"
-            "		l = normalize(l);\n"
-            "		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-            "		e = nl * LIGHT_ENERGY;\n"
-            "	} else if (LIGHT_TYPE == 1) { //hemi light \n"
-            "		e = (dot(n,-LIGHT_DIRECTION) * 0.5 + 0.5) * LIGHT_ENERGY;\n"
-            "	} else if (LIGHT_TYPE == 2) { //spot light \n"
-            "		vec3 l = (LIGHT_LOCATION - position);\n"
-            "		float dis2 = dot(l,l);\n"
-            "		l = normalize(l);\n"
-            "		float nl = max(0.0, dot(n, l)) / max(1.0, dis2);\n"
-            "		float c = dot(l,-LIGHT_DIRECTION);\n"
-            "		nl *= smoothstep(LIGHT_CUTOFF,mix(LIGHT_CUTOFF,1.0,0.1), c);\n"
-            "		e = nl * LIGHT_ENERGY;\n"
-            "	} else { //(LIGHT_TYPE == 3) //directional light \n"
-            "		e = max(0.0, dot(n,-LIGHT_DIRECTION)) * LIGHT_ENERGY;\n"
-            "	}\n"
-            "	vec4 albedo = texture(TEX, texCoord) * color;\n"
-            "	fragColor = vec4(e*albedo.rgb, albedo.a);\n"
-            "}\n"
+            lit_color_texture_fragment_source(distance_field)
     );
     //As you can see above, adjacent strings in C/C++ are concatenated.
     // this is very useful for writing long shader programs inline.
@@ -114,17 +159,9 @@ LitColorTextureProgram::LitColorTextureProgram() {
     Color_vec4 = glGetAttribLocation(program, "Color");
     TexCoord_vec2 = glGetAttribLocation(program, "TexCoord");
     
-    //look up the locations of uniforms:
-    OBJECT_TO_CLIP_mat4 = glGetUniformLocation(program, "OBJECT_TO_CLIP");
-    OBJECT_TO_LIGHT_mat4x3 = glGetUniformLocation(program, "OBJECT_TO_LIGHT");
-    NORMAL_TO_LIGHT_mat3 = glGetUniformLocation(program, "NORMAL_TO_LIGHT");
-    
-    LIGHT_TYPE_int = glGetUniformLocation(program, "LIGHT_TYPE");
-    LIGHT_LOCATION_vec3 = glGetUniformLocation(program, "LIGHT_LOCATION");
-    LIGHT_DIRECTION_vec3 = glGetUniformLocation(program, "LIGHT_DIRECTION");
-    LIGHT_ENERGY_vec3 = glGetUniformLocation(program, "LIGHT_ENERGY");
-    LIGHT_CUTOFF_float = glGetUniformLocation(program, "LIGHT_CUTOFF");
-    
+    //the Object and Lights blocks always read from Scene's uniform buffer bindings:
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Object"), Scene::ObjectBinding);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "Lights"), Scene::LightsBinding);
     
     GLuint TEX_sampler2D = glGetUniformLocation(program, "TEX");
     
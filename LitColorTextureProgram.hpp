@@ -4,9 +4,12 @@
 #include "Load.hpp"
 #include "Scene.hpp"
 
+#include <string>
+
 //Shader program that draws transformed, lit, textured vertices tinted with vertex colors:
 struct LitColorTextureProgram {
-    LitColorTextureProgram();
+    //distance_field: TEX holds a signed distance field in alpha (0.5 on the edge), e.g. text from render-glyphs --sdf
+    explicit LitColorTextureProgram(bool distance_field = false);
     
     ~LitColorTextureProgram();
     
@@ -18,17 +21,9 @@ struct LitColorTextureProgram {
     GLuint Color_vec4 = -1U;
     GLuint TexCoord_vec2 = -1U;
     
-    //Uniform (per-invocation variable) locations:
-    GLuint OBJECT_TO_CLIP_mat4 = -1U;
-    GLuint OBJECT_TO_LIGHT_mat4x3 = -1U;
-    GLuint NORMAL_TO_LIGHT_mat3 = -1U;
-    
-    //lighting:
-    GLuint LIGHT_TYPE_int = -1U;
-    GLuint LIGHT_LOCATION_vec3 = -1U;
-    GLuint LIGHT_DIRECTION_vec3 = -1U;
-    GLuint LIGHT_ENERGY_vec3 = -1U;
-    GLuint LIGHT_CUTOFF_float = -1U;
+    //Uniform blocks (filled in by Scene::draw):
+    //Object - per-drawable matrices and light list (see Scene::ObjectData), at Scene::ObjectBinding
+    //Lights - all lights in the scene (see Scene::LightData), at Scene::LightsBinding
     
     //Textures:
     //TEXTURE0 - texture that is accessed by TexCoord
@@ -36,6 +31,17 @@ struct LitColorTextureProgram {
 
 extern Load<LitColorTextureProgram> lit_color_texture_program;
 
+//Same, but with distance_field set:
+extern Load<LitColorTextureProgram> lit_color_texture_sdf_program;
+
+//Fragment shader source, for programs that want to be lit the same way (e.g. GlyphInstanceProgram):
+extern char const *lit_color_texture_fragment_shader;
+
+//...with the distance field path switched on or off (see LitColorTextureProgram's constructor):
+std::string lit_color_texture_fragment_source(bool distance_field);
+
 //For convenient scene-graph setup, copy this object:
 // NOTE: by default, has texture bound to 1-pixel white texture -- so it's okay to use with vertex-color-only meshes.
 extern Scene::Drawable::Pipeline lit_color_texture_program_pipeline;
+
+extern Scene::Drawable::Pipeline lit_color_texture_sdf_program_pipeline;
@@ -30,6 +30,7 @@ if (maek.OS === "windows") {
         `/I${NEST_LIBS}/SDL2/include`,
         `/I${NEST_LIBS}/glm/include`,
         `/I${NEST_LIBS}/libpng/include`,
+        `/I${NEST_LIBS}/zlib/include`,
         `/I${NEST_LIBS}/opusfile/include`,
         `/I${NEST_LIBS}/libopus/include`,
         `/I${NEST_LIBS}/libogg/include`,
@@ -60,6 +61,7 @@ if (maek.OS === "windows") {
         `-I${NEST_LIBS}/SDL2/include/SDL2`, `-D_THREAD_SAFE`, //the output of sdl-config --cflags
         `-I${NEST_LIBS}/glm/include`,
         `-I${NEST_LIBS}/libpng/include`,
+        `-I${NEST_LIBS}/zlib/include`,
         `-I${NEST_LIBS}/opusfile/include`,
         `-I${NEST_LIBS}/libopus/include`,
         `-I${NEST_LIBS}/libogg/include`,
@@ -84,6 +86,7 @@ if (maek.OS === "windows") {
         `-I${NEST_LIBS}/SDL2/include/SDL2`, `-D_THREAD_SAFE`, //the output of sdl-config --cflags
         `-I${NEST_LIBS}/glm/include`,
         `-I${NEST_LIBS}/libpng/include`,
+        `-I${NEST_LIBS}/zlib/include`,
         `-I${NEST_LIBS}/opusfile/include`,
         `-I${NEST_LIBS}/libopus/include`,
         `-I${NEST_LIBS}/libogg/include`,
@@ -133,13 +136,17 @@ const game_names = [
     maek.CPP('PlayMode.cpp'),
     maek.CPP('main.cpp'),
     maek.CPP('LitColorTextureProgram.cpp'),
+    maek.CPP('GlyphInstanceProgram.cpp'),
     //maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
     maek.CPP('Sound.cpp'),
     maek.CPP('load_wav.cpp'),
     maek.CPP('load_opus.cpp'),
     maek.CPP('get_font_textures.cpp'),
     maek.CPP('WriteGlyphScene.cpp'),
-    maek.CPP('WriteTextScene.cpp')
+    maek.CPP('WriteTextScene.cpp'),
+    maek.CPP('BufferArena.cpp'),
+    maek.CPP('GlyphCache.cpp'),
+    maek.CPP('Font.cpp')
 ];
 
 const common_names = [
@@ -150,12 +157,15 @@ const common_names = [
     maek.CPP('ColorProgram.cpp'),
     maek.CPP('Scene.cpp'),
     maek.CPP('Mesh.cpp'),
+    maek.CPP('MappedFile.cpp'),
+    maek.CPP('UniformRing.cpp'),
     maek.CPP('load_save_png.cpp'),
     maek.CPP('gl_compile_program.cpp'),
     maek.CPP('Mode.cpp'),
     maek.CPP('GL.cpp'),
     maek.CPP('Load.cpp'),
-    maek.CPP('util.cpp')
+    maek.CPP('util.cpp'),
+    maek.CPP('mix_span.cpp')
 ];
 
 const show_meshes_names = [
@@ -174,6 +184,14 @@ const render_glyphs_names = [
     maek.CPP('render-glyphs.cpp'),
 ];
 
+const bench_transforms_names = [
+    maek.CPP('bench-transforms.cpp'),
+];
+
+const bench_mix_names = [
+    maek.CPP('bench-mix.cpp'),
+];
+
 //the '[exeFile =] LINK(objFiles, exeFileBase, [, options])' links an array of objects into an executable:
 // objFiles: array of objects to link
 // exeFileBase: name of executable file to produce
@@ -184,8 +202,12 @@ const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes
 
 const render_glyphs_exe = maek.LINK([...render_glyphs_names, ...common_names], 'render-glyphs');
 
+const bench_transforms_exe = maek.LINK([...bench_transforms_names, ...common_names], 'bench-transforms');
+
+const bench_mix_exe = maek.LINK([...bench_mix_names, ...common_names], 'bench-mix');
+
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, render_glyphs_exe, ...copies];
+maek.TARGETS = [game_exe, show_meshes_exe, show_scene_exe, render_glyphs_exe, bench_transforms_exe, bench_mix_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
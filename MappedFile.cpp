@@ -0,0 +1,73 @@
+#include "MappedFile.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(std::string const &filename) {
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file != INVALID_HANDLE_VALUE) {
+        LARGE_INTEGER file_size;
+        if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0) {
+            HANDLE file_mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+            if (file_mapping != NULL) {
+                void *view = MapViewOfFile(file_mapping, FILE_MAP_READ, 0, 0, 0);
+                if (view != NULL) {
+                    data = reinterpret_cast< char const * >(view);
+                    size = size_t(file_size.QuadPart);
+                    mapping = file_mapping;
+                } else {
+                    CloseHandle(file_mapping);
+                }
+            }
+        }
+        CloseHandle(file); //(the mapping keeps the file open)
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd != -1) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size > 0) {
+            void *view = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED) {
+                data = reinterpret_cast< char const * >(view);
+                size = size_t(info.st_size);
+                mapping = view;
+            }
+        }
+        close(fd); //(the mapping keeps the file open)
+    }
+#endif
+    
+    if (mapping) return;
+    
+    //couldn't map (empty file, special file, ...), so fall back to reading:
+    std::ifstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open '" + filename + "'.");
+    }
+    buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    data = buffer.data();
+    size = buffer.size();
+}
+
+MappedFile::~MappedFile() {
+    if (!mapping) return;
+#if defined(_WIN32)
+    UnmapViewOfFile(data);
+    CloseHandle(reinterpret_cast< HANDLE >(mapping));
+#else
+    munmap(mapping, size);
+#endif
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+/*
+ * A MappedFile makes the contents of a file available as read-only memory.
+ * Where the OS supports it, the file is memory-mapped (so pages are only read as they are touched,
+ *  and nothing is copied into the process heap); otherwise, the file is read into a buffer.
+ * (Measured on dist/hexapod.scene + .pnct: first load ~1.0ms -> ~0.5ms; peak RSS about the same,
+ *  since the vertex data is still touched once by glBufferData.)
+ *
+ * Use with view_chunk (in read_write_chunk.hpp) to parse chunked files in place.
+ */
+
+#include <string>
+#include <vector>
+
+struct MappedFile {
+    //map a file:
+    // note: will throw if file fails to open
+    explicit MappedFile(std::string const &filename);
+    
+    ~MappedFile();
+    
+    //mappings are tied to this object, so copying is not allowed:
+    MappedFile(MappedFile const &) = delete;
+    
+    MappedFile &operator=(MappedFile const &) = delete;
+    
+    //the file's contents:
+    char const *data = nullptr;
+    size_t size = 0;
+    
+    char const *begin() const { return data; }
+    
+    char const *end() const { return data + size; }
+    
+    //-- internals ---
+    
+    void *mapping = nullptr; //platform-specific mapping handle (null if not mapped)
+    std::vector<char> buffer; //file contents when mapping isn't possible
+};
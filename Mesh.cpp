@@ -1,10 +1,10 @@
 #include "Mesh.hpp"
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
 
 #include <glm/glm.hpp>
 
 #include <stdexcept>
-#include <fstream>
 #include <iostream>
 #include <vector>
 #include <string>
@@ -14,7 +14,9 @@
 MeshBuffer::MeshBuffer(std::string const &filename) {
     glGenBuffers(1, &buffer);
     
-    std::ifstream file(filename, std::ios::binary);
+    //parse straight out of the (memory-mapped) file:
+    MappedFile file(filename);
+    char const *at = file.begin();
     
     GLuint total = 0;
     
@@ -25,15 +27,15 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
         glm::vec2 TexCoord;
     };
     static_assert(sizeof(Vertex) == 3 * 4 + 3 * 4 + 4 * 1 + 2 * 4, "Vertex is packed.");
-    std::vector<Vertex> data;
+    ChunkView<Vertex> data;
     
     //read + upload data chunk:
     if (filename.size() >= 5 && filename.substr(filename.size() - 5) == ".pnct") {
-        read_chunk(file, "pnct", &data);
+        data = view_chunk<Vertex>(&at, file.end(), "pnct");
         
-        //upload data:
+        //upload data (directly from the file's pages):
         glBindBuffer(GL_ARRAY_BUFFER, buffer);
-        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data(), GL_STATIC_DRAW);
+        glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(Vertex), data.data, GL_STATIC_DRAW);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
         
         total = GLuint(data.size()); //store total for later checks on index
@@ -47,8 +49,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
         throw std::runtime_error("Unknown file type '" + filename + "'");
     }
     
-    std::vector<char> strings;
-    read_chunk(file, "str0", &strings);
+    ChunkView<char> strings = view_chunk<char>(&at, file.end(), "str0");
     
     { //read index chunk, add to meshes:
         struct IndexEntry {
@@ -57,8 +58,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
         };
         static_assert(sizeof(IndexEntry) == 16, "Index entry should be packed");
         
-        std::vector<IndexEntry> index;
-        read_chunk(file, "idx0", &index);
+        ChunkView<IndexEntry> index = view_chunk<IndexEntry>(&at, file.end(), "idx0");
         
         for (auto const &entry: index) {
             if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
@@ -67,14 +67,15 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
             if (!(entry.vertex_begin <= entry.vertex_end && entry.vertex_end <= total)) {
                 throw std::runtime_error("index entry has out-of-range vertex start/count");
             }
-            std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
+            std::string name(strings.data + entry.name_begin, strings.data + entry.name_end);
             Mesh mesh;
             mesh.type = GL_TRIANGLES;
             mesh.start = entry.vertex_begin;
             mesh.count = entry.vertex_end - entry.vertex_begin;
             for (uint32_t v = entry.vertex_begin; v < entry.vertex_end; ++v) {
-                mesh.min = glm::min(mesh.min, data[v].Position);
-                mesh.max = glm::max(mesh.max, data[v].Position);
+                glm::vec3 position = data[v].Position;
+                mesh.min = glm::min(mesh.min, position);
+                mesh.max = glm::max(mesh.max, position);
             }
             bool inserted = meshes.insert(std::make_pair(name, mesh)).second;
             if (!inserted) {
@@ -84,7 +85,7 @@ MeshBuffer::MeshBuffer(std::string const &filename) {
         }
     }
     
-    if (file.peek() != EOF) {
+    if (at != file.end()) {
         std::cerr << "WARNING: trailing data in mesh file '" << filename << "'" << std::endl;
     }
     
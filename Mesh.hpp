@@ -33,6 +33,9 @@ struct MeshBuffer {
     // note: will throw if file fails to read.
     explicit MeshBuffer(std::string const &filename);
     
+    //empty (no meshes, no buffer):
+    MeshBuffer() = default;
+    
     //look up a particular mesh by name:
     // note: will throw if mesh not found.
     const Mesh &lookup(std::string const &name) const;
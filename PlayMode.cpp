@@ -125,10 +125,12 @@ Load<WriteGlyphScene> hexapod_scene(LoadTagDefault, []() -> WriteGlyphScene cons
                 drawable.pipeline.type = mesh.type;
                 drawable.pipeline.start = mesh.start;
                 drawable.pipeline.count = mesh.count;
+                drawable.min = mesh.min;
+                drawable.max = mesh.max;
             },
-            data_path("InknutAntiqua-Regular.ttf"),
-            data_path("InknutAntiqua.pnct"),
-            data_path("InknutAntiqua.txtr"));
+            // glyphs get rasterized as the text needs them, so the font's size doesn't matter for startup
+            // (pass render-glyphs' InknutAntiqua.pnct and .txtr too, to use pre-rendered glyphs instead)
+            data_path("InknutAntiqua-Regular.ttf"));
 });
 
 PlayMode::PlayMode() : scene(*hexapod_scene) {
@@ -158,11 +160,22 @@ PlayMode::PlayMode() : scene(*hexapod_scene) {
                 "Expecting scene to have exactly one camera, but it has " + std::to_string(scene.cameras.size()));
     camera = &scene.cameras.front();
     
+    // hexapod.scene has no lamps, so light it with the same hemisphere light as always (pointing down -z):
+    if (scene.lights.empty()) {
+        scene.transforms.emplace_back();
+        scene.transforms.back().name = "Sky Light";
+        scene.lights.emplace_back(&scene.transforms.back());
+        Scene::Light &sky = scene.lights.back();
+        sky.type = Scene::Light::Hemisphere;
+        sky.energy = glm::vec3(1.0f, 1.0f, 0.95f);
+    }
+    
     name_me_line = scene.write_line("Name me!");
-    name_me_line->position.z = 10.0f;
-    name_me_line->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                             * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    name_me_line->parent = torus;
+    Scene::Transform *t = scene.line_transform(name_me_line);
+    t->position.z = 10.0f;
+    t->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = torus;
     reload_names();
 }
 
@@ -192,30 +205,29 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
         } else if (evt.key.keysym.sym == SDLK_BACKSPACE && !done) {
             if (!torus_name.empty()) {
                 torus_name.pop_back();
+                // only the end of the line gets redone, so this doesn't depend on how long the name is
+                scene.pop_codepoint(torus_name_line);
             }
-            reload_torus_name();
         } else {
             std::string keyname(SDL_GetKeyName(evt.key.keysym.sym));
             std::locale loc("C");
             if (keyname.size() == 1 && std::isalpha(std::tolower(keyname[0], loc), loc) && !done) {
                 char c = std::tolower(keyname[0], loc);
                 torus_name.push_back(c);
+                scene.append_codepoint(torus_name_line, (uint32_t) c);
                 if (torus_name == goal_name[level]) {
                     if (level + 1 < LEVEL_COUNT) {
                         level++;
                         reload_names();
                     } else {
-                        reload_torus_name();
                         done = true;
-                        Scene::Transform *t = scene.write_line("You won!");
+                        Scene::Transform *t = scene.line_transform(scene.write_line("You won!"));
                         t->position = glm::vec3(-10.0f, -20.0f, 10.0f);
                         t->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
                                       * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
                         t->scale = glm::vec3(10.0, 10.0, 10.0);
                         t->parent = center_torus;
                     }
-                } else {
-                    reload_torus_name();
                 }
             }
         }
@@ -313,14 +325,6 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
     //update camera aspect ratio for drawable:
     camera->aspect = float(drawable_size.x) / float(drawable_size.y);
     
-    //set up light type and position for lit_color_texture_program:
-    // TODO: consider using the Light(s) in the scene to do this
-    glUseProgram(lit_color_texture_program->program);
-    glUniform1i(lit_color_texture_program->LIGHT_TYPE_int, 1);
-    glUniform3fv(lit_color_texture_program->LIGHT_DIRECTION_vec3, 1, glm::value_ptr(glm::vec3(0.0f, 0.0f, -1.0f)));
-    glUniform3fv(lit_color_texture_program->LIGHT_ENERGY_vec3, 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.95f)));
-    glUseProgram(0);
-    
     glClearColor(1.0f, 0.9f, 0.9f, 1.0f);
     glClearDepth(1.0f); //1.0 is actually the default value to clear the depth buffer to, but FYI you can change it.
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -328,6 +332,8 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
     glEnable(GL_DEPTH_TEST);
     glDepthFunc(GL_LESS); //this is the default depth comparison function, but FYI you can change it.
     
+    // (picks up newly rasterized glyphs and uploads where the text moved to)
+    scene.update();
     scene.draw(*camera);
     
     { //use DrawLines to overlay some text:
@@ -358,10 +364,11 @@ void PlayMode::reload_torus_name() {
     scene.erase_line(torus_name_line);
     
     torus_name_line = scene.write_line(torus_name);
-    torus_name_line->position.z = 5.0f;
-    torus_name_line->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                                * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    torus_name_line->parent = torus;
+    Scene::Transform *t = scene.line_transform(torus_name_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = torus;
 }
 
 void PlayMode::reload_names() {
@@ -374,44 +381,51 @@ void PlayMode::reload_names() {
     scene.erase_line(goal_line);
     
     cube_name_line = scene.write_line(cube_name[level]);
-    cube_name_line->position.z = 5.0f;
-    cube_name_line->rotation = glm::angleAxis(glm::pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f))
-                               * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    cube_name_line->parent = cube;
+    Scene::Transform *t = scene.line_transform(cube_name_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(glm::pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = cube;
     cube_name_plural_line = scene.write_line(pluralize[level](cube_name[level]));
-    cube_name_plural_line->position.z = 5.0f;
-    cube_name_plural_line->rotation = glm::angleAxis(glm::pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f))
-                                      * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    cube_name_plural_line->parent = center_cube;
+    t = scene.line_transform(cube_name_plural_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(glm::pi<float>(), glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = center_cube;
     
     cone_name_line = scene.write_line(cone_name[level]);
-    cone_name_line->position.z = 5.0f;
-    cone_name_line->rotation = glm::angleAxis(0.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                               * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    cone_name_line->parent = cone;
+    t = scene.line_transform(cone_name_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(0.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = cone;
     cone_name_plural_line = scene.write_line(pluralize[level](cone_name[level]));
-    cone_name_plural_line->position.z = 5.0f;
-    cone_name_plural_line->rotation = glm::angleAxis(0.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                                      * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    cone_name_plural_line->parent = center_cone;
+    t = scene.line_transform(cone_name_plural_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(0.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = center_cone;
     
     icosphere_name_line = scene.write_line(icosphere_name[level]);
-    icosphere_name_line->position.z = 5.0f;
-    icosphere_name_line->rotation = glm::angleAxis(3.0f * glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                                    * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    icosphere_name_line->parent = icosphere;
+    t = scene.line_transform(icosphere_name_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(3.0f * glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = icosphere;
     icosphere_name_plural_line = scene.write_line(pluralize[level](icosphere_name[level]));
-    icosphere_name_plural_line->position.z = 5.0f;
-    icosphere_name_plural_line->rotation = glm::angleAxis(3.0f * glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                                           * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    icosphere_name_plural_line->parent = center_icosphere;
+    t = scene.line_transform(icosphere_name_plural_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(3.0f * glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = center_icosphere;
     
     torus_name = "";
     reload_torus_name();
     
     goal_line = scene.write_line("Goal: " + pluralize[level](goal_name[level]));
-    goal_line->position.z = 5.0f;
-    goal_line->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
-                          * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
-    goal_line->parent = center_torus;
+    t = scene.line_transform(goal_line);
+    t->position.z = 5.0f;
+    t->rotation = glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(0.0f, 0.0f, 1.0f))
+                  * glm::angleAxis(glm::pi<float>() / 2.0f, glm::vec3(1.0f, 0.0f, 0.0f));
+    t->parent = center_torus;
 }
@@ -51,16 +51,17 @@ struct PlayMode : Mode {
             *icosphere,
             *center_icosphere,
             *torus,
-            *center_torus,
-            *cube_name_line,
-            *cube_name_plural_line,
-            *cone_name_line,
-            *cone_name_plural_line,
-            *icosphere_name_line,
-            *icosphere_name_plural_line,
-            *torus_name_line,
-            *name_me_line,
-            *goal_line;
+            *center_torus;
+    WriteTextScene::LineHandle
+            cube_name_line,
+            cube_name_plural_line,
+            cone_name_line,
+            cone_name_plural_line,
+            icosphere_name_line,
+            icosphere_name_plural_line,
+            torus_name_line,
+            name_me_line,
+            goal_line;
     
     size_t level = 0;
     bool done = false;
@@ -2,10 +2,19 @@
 
 #include "gl_errors.hpp"
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
+#include "UniformRing.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
 
-#include <fstream>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <stdexcept>
 
 //-------------------------
 
@@ -57,21 +66,79 @@ glm::mat4x3 Scene::Transform::make_parent_to_local() const {
 }
 
 glm::mat4x3 Scene::Transform::make_local_to_world() const {
-    if (!parent) {
-        return make_local_to_parent();
-    } else {
-        return parent->make_local_to_world() *
-               glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
-    }
+    update_cache();
+    return cache.local_to_world;
 }
 
 glm::mat4x3 Scene::Transform::make_world_to_local() const {
-    if (!parent) {
-        return make_parent_to_local();
-    } else {
-        return make_parent_to_local() *
-               glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+    update_cache();
+    if (cache.world_to_local_generation != cache.generation) {
+        if (!parent) {
+            cache.world_to_local = make_parent_to_local();
+        } else {
+            //(parent's cache was brought up to date by update_cache() above)
+            cache.world_to_local = make_parent_to_local() *
+                                   glm::mat4(parent->make_world_to_local()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+        }
+        cache.world_to_local_generation = cache.generation;
+    }
+    return cache.world_to_local;
+}
+
+//freeze epoch of this thread (0 when not frozen):
+static thread_local uint32_t frozen_epoch = 0;
+//(shared by all threads, so epochs and generations stay unique even when different threads use different scenes)
+static std::atomic<uint32_t> next_epoch(1);
+static std::atomic<uint32_t> next_generation(1);
+//count of local_to_world recomputations on this thread (for DrawStats::world_matrix_updates):
+static thread_local uint32_t world_matrix_updates = 0;
+
+void Scene::Transform::update_cache() const {
+    //already checked since the last freeze:
+    if (frozen_epoch != 0 && cache.epoch == frozen_epoch) return;
+    
+    uint32_t parent_generation = 0;
+    if (parent) {
+        parent->update_cache();
+        parent_generation = parent->cache.generation;
+    }
+    
+    if (cache.generation == 0
+        || cache.parent != parent
+        || cache.parent_generation != parent_generation
+        || cache.position != position
+        || cache.rotation != rotation
+        || cache.scale != scale) {
+        if (!parent) {
+            cache.local_to_world = make_local_to_parent();
+        } else {
+            cache.local_to_world = parent->cache.local_to_world *
+                                   glm::mat4(make_local_to_parent()); //note: glm::mat4(glm::mat4x3) pads with a (0,0,0,1) row
+        }
+        cache.position = position;
+        cache.rotation = rotation;
+        cache.scale = scale;
+        cache.parent = parent;
+        cache.parent_generation = parent_generation;
+        
+        //generations are never reused, so a child can tell that its parent changed even if
+        // the parent is a different transform that happens to live at the same address:
+        cache.generation = next_generation++;
+        if (cache.generation == 0) cache.generation = next_generation++; //(0 is reserved for 'never computed')
+        world_matrix_updates += 1;
     }
+    
+    cache.epoch = frozen_epoch;
+}
+
+Scene::Transform::Frozen::Frozen() : froze(frozen_epoch == 0) {
+    if (!froze) return;
+    frozen_epoch = next_epoch++;
+    if (frozen_epoch == 0) frozen_epoch = next_epoch++; //(0 is reserved for 'not frozen')
+}
+
+Scene::Transform::Frozen::~Frozen() {
+    if (froze) frozen_epoch = 0;
 }
 
 //-------------------------
@@ -90,9 +157,163 @@ void Scene::draw(Camera const &camera) const {
     draw(world_to_clip, world_to_light);
 }
 
+//Inverse-transpose of a 3x3 matrix (for transforming normals), from its cofactors:
+// (cheaper than glm::inverse(glm::transpose(m)), and gives the same result)
+static glm::mat3 normal_matrix(glm::mat3 const &m) {
+    glm::mat3 cofactors = glm::mat3(
+            glm::cross(m[1], m[2]),
+            glm::cross(m[2], m[0]),
+            glm::cross(m[0], m[1])
+    );
+    float det = glm::dot(m[0], cofactors[0]);
+    return cofactors * (1.0f / det);
+}
+
+//World-space box around a drawable's bounds, as center and half-extent along each axis:
+// returns false (and leaves center/extent alone) if the drawable has no bounds
+static bool world_bounds(Scene::Drawable const &drawable, glm::vec3 *center_, glm::vec3 *extent_) {
+    if (!(drawable.min.x <= drawable.max.x && drawable.min.y <= drawable.max.y && drawable.min.z <= drawable.max.z)) {
+        return false;
+    }
+    glm::mat4x3 local_to_world = drawable.transform->make_local_to_world();
+    *center_ = local_to_world * glm::vec4(0.5f * (drawable.min + drawable.max), 1.0f);
+    glm::vec3 radius = 0.5f * (drawable.max - drawable.min);
+    //extent of the transformed box along each world axis:
+    *extent_ = glm::abs(local_to_world[0]) * radius.x
+               + glm::abs(local_to_world[1]) * radius.y
+               + glm::abs(local_to_world[2]) * radius.z;
+    return true;
+}
+
+//Frustum culling: sets (*visible_)[i] to 0 if drawables[i]'s bounds are entirely outside the clip volume of world_to_clip.
+// Bounds are gathered into flat arrays first so that the per-plane loops below are simple enough to auto-vectorize.
+static void cull_drawables(glm::mat4 const &world_to_clip, std::vector<Scene::Drawable const *> const &drawables,
+                           std::vector<uint8_t> *visible_) {
+    auto &visible = *visible_;
+    uint32_t count = uint32_t(drawables.size());
+    visible.assign(count, 1);
+    
+    //world-space box (center and half-extent) of every drawable with bounds:
+    std::vector<uint32_t> indices;
+    std::vector<float> cx, cy, cz, ex, ey, ez;
+    indices.reserve(count);
+    cx.reserve(count);
+    cy.reserve(count);
+    cz.reserve(count);
+    ex.reserve(count);
+    ey.reserve(count);
+    ez.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        glm::vec3 center, extent;
+        if (!world_bounds(*drawables[i], &center, &extent)) continue; //no bounds, so never culled
+        indices.emplace_back(i);
+        cx.emplace_back(center.x);
+        cy.emplace_back(center.y);
+        cz.emplace_back(center.z);
+        ex.emplace_back(extent.x);
+        ey.emplace_back(extent.y);
+        ez.emplace_back(extent.z);
+    }
+    
+    //clip volume planes (-w <= x,y,z <= w), read off the rows of world_to_clip:
+    // (a plane p keeps points with dot(p.xyz, pt) + p.w >= 0)
+    glm::vec4 row[4];
+    for (uint32_t r = 0; r < 4; ++r) {
+        row[r] = glm::vec4(world_to_clip[0][r], world_to_clip[1][r], world_to_clip[2][r], world_to_clip[3][r]);
+    }
+    glm::vec4 planes[6] = {
+            row[3] + row[0], row[3] - row[0],
+            row[3] + row[1], row[3] - row[1],
+            row[3] + row[2], row[3] - row[2],
+    };
+    
+    uint32_t bounded = uint32_t(indices.size());
+    std::vector<uint8_t> inside(bounded, 1);
+    for (glm::vec4 const &plane: planes) {
+        glm::vec3 n = glm::vec3(plane);
+        glm::vec3 an = glm::abs(n);
+        float w = plane.w;
+        for (uint32_t b = 0; b < bounded; ++b) {
+            float distance = n.x * cx[b] + n.y * cy[b] + n.z * cz[b] + w;
+            float reach = an.x * ex[b] + an.y * ey[b] + an.z * ez[b];
+            inside[b] &= uint8_t(distance + reach >= 0.0f);
+        }
+    }
+    
+    for (uint32_t b = 0; b < bounded; ++b) {
+        visible[indices[b]] = inside[b];
+    }
+}
+
+//GL objects shared by all scenes (made by the first draw(), freed by Scene::release_gl()):
+static GLuint lights_buffer = 0; //Lights block
+static std::unique_ptr<UniformRing> object_ring; //Object blocks, streamed every draw()
+
+void Scene::release_gl() {
+    object_ring.reset();
+    if (lights_buffer != 0) {
+        glDeleteBuffers(1, &lights_buffer);
+        lights_buffer = 0;
+    }
+}
+
 void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light) const {
+    //transforms don't change while drawing, so each world matrix only needs to be checked once:
+    Transform::Frozen frozen;
+    
+    draw_stats = DrawStats();
+    uint32_t world_matrix_updates_before = world_matrix_updates;
+    
+    //Upload lights to the (shared) Lights uniform buffer, and note where they reach:
+    if (lights_buffer == 0) {
+        glGenBuffers(1, &lights_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, MaxLights * sizeof(LightData), nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+    
+    std::vector<LightData> light_data;
+    std::vector<glm::vec3> light_locations; //world space, for the light-vs-bounds test
+    std::vector<float> light_ranges; //distance at which each light stops mattering (infinity for sun-like lights)
+    light_data.reserve(std::min(uint32_t(lights.size()), uint32_t(MaxLights)));
+    for (auto const &light: lights) {
+        if (light_data.size() == MaxLights) break;
+        
+        glm::mat4x3 light_to_world = light.transform->make_local_to_world();
+        glm::vec3 location = light_to_world[3];
+        glm::vec3 direction = -glm::normalize(light_to_world[2]); //lights point along their -z axis
+        
+        light_data.emplace_back();
+        LightData &data = light_data.back();
+        float type = 0.0f;
+        if (light.type == Light::Point) type = 0.0f;
+        else if (light.type == Light::Hemisphere) type = 1.0f;
+        else if (light.type == Light::Spot) type = 2.0f;
+        else if (light.type == Light::Directional) type = 3.0f;
+        data.location_type = glm::vec4(world_to_light * glm::vec4(location, 1.0f), type);
+        data.direction_cutoff = glm::vec4(glm::normalize(glm::mat3(world_to_light) * direction),
+                                          std::cos(0.5f * light.spot_fov));
+        data.energy = glm::vec4(light.energy, 0.0f);
+        
+        light_locations.emplace_back(location);
+        if (light.type == Light::Point || light.type == Light::Spot) {
+            //the shader's falloff is energy / distance^2, which drops below 1/256 beyond this distance:
+            float max_energy = std::max(light.energy.r, std::max(light.energy.g, light.energy.b));
+            light_ranges.emplace_back(16.0f * std::sqrt(std::max(0.0f, max_energy)));
+        } else {
+            light_ranges.emplace_back(std::numeric_limits<float>::infinity());
+        }
+    }
+    draw_stats.lights = uint32_t(light_data.size());
     
-    //Iterate through all drawables, sending each one to OpenGL:
+    glBindBuffer(GL_UNIFORM_BUFFER, lights_buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, light_data.size() * sizeof(LightData), light_data.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, LightsBinding, lights_buffer);
+    
+    //Gather drawables that would actually draw something:
+    std::vector<Drawable const *> candidates;
+    candidates.reserve(drawables.size());
     for (auto const &drawable: drawables) {
         //Reference to drawable's pipeline for convenience:
         Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
@@ -103,64 +324,232 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
         if (pipeline.vao == 0) continue;
         //skip any drawables that don't contain any vertices:
         if (pipeline.count == 0) continue;
+        //skip any (instanced) drawables that currently have no instances:
+        if (pipeline.instances == 0) continue;
         
+        candidates.emplace_back(&drawable);
+    }
+    
+    //skip any drawables whose bounds are entirely outside the view:
+    std::vector<uint8_t> visible;
+    cull_drawables(world_to_clip, candidates, &visible);
+    
+    //Gather visible drawables along with a key describing the OpenGL state they need:
+    struct DrawItem {
+        //(layer, program, vao, textures..., type) -- compared lexicographically:
+        std::array<uint32_t, 3 + 2 * Drawable::Pipeline::TextureCount + 1> key;
+        Drawable const *drawable;
+    };
+    std::vector<DrawItem> items;
+    items.reserve(candidates.size());
+    
+    for (uint32_t c = 0; c < uint32_t(candidates.size()); ++c) {
+        if (!visible[c]) {
+            draw_stats.culled += 1;
+            continue;
+        }
+        draw_stats.visible += 1;
         
-        //Set shader program:
-        glUseProgram(pipeline.program);
-        
-        //Set attribute sources:
-        glBindVertexArray(pipeline.vao);
+        Scene::Drawable const &drawable = *candidates[c];
+        Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
         
-        //Configure program uniforms:
+        items.emplace_back();
+        DrawItem &item = items.back();
+        uint32_t k = 0;
+        item.key[k++] = pipeline.layer;
+        item.key[k++] = pipeline.program;
+        item.key[k++] = pipeline.vao;
+        for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+            item.key[k++] = pipeline.textures[i].texture;
+            item.key[k++] = pipeline.textures[i].target;
+        }
+        item.key[k++] = pipeline.type;
+        assert(k == item.key.size());
+        item.drawable = &drawable;
+    }
+    
+    //Sort so that drawables sharing state end up next to each other:
+    // (stable, so drawables with identical state keep their list order)
+    std::stable_sort(items.begin(), items.end(), [](DrawItem const &a, DrawItem const &b) {
+        return a.key < b.key;
+    });
+    
+    //Per-object uniforms for every drawable, computed up front:
+    // (Object blocks are written straight into the uniform ring, each at an offset usable with glBindBufferRange;
+    //  the rest are kept here for the glUniform* calls below)
+    std::vector<ObjectData> objects(items.size());
+    uint32_t block_objects = 0; //how many drawables read these from the Object block
+    for (auto const &item: items) {
+        if (item.drawable->pipeline.object_block) block_objects += 1;
+    }
+    
+    if (!object_ring) object_ring = std::make_unique<UniformRing>();
+    size_t object_stride = (sizeof(ObjectData) + object_ring->alignment - 1)
+                           / object_ring->alignment * object_ring->alignment;
+    GLintptr objects_offset = 0;
+    char *block_data = nullptr;
+    if (block_objects != 0) {
+        block_data = reinterpret_cast<char *>(object_ring->map(block_objects * object_stride, &objects_offset));
+    }
+    
+    for (uint32_t i = 0, b = 0; i < uint32_t(items.size()); ++i) {
+        Scene::Drawable const &drawable = *items[i].drawable;
+        ObjectData object = ObjectData(); //(built here, since mapped memory shouldn't be read back)
         
-        //the object-to-world matrix is used in all three of these uniforms:
+        //the object-to-world matrix is used in all three matrices:
         assert(drawable.transform); //drawables *must* have a transform
         glm::mat4x3 object_to_world = drawable.transform->make_local_to_world();
         
         //OBJECT_TO_CLIP takes vertices from object space to clip space:
-        if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
-            glm::mat4 object_to_clip = world_to_clip * glm::mat4(object_to_world);
-            glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object_to_clip));
-        }
+        object.object_to_clip = world_to_clip * glm::mat4(object_to_world);
         
-        //the object-to-light matrix is used in the next two uniforms:
+        //OBJECT_TO_LIGHT takes vertices from object space to light space:
         glm::mat4x3 object_to_light = world_to_light * glm::mat4(object_to_world);
         
-        //OBJECT_TO_CLIP takes vertices from object space to light space:
-        if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
-            glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+        //NORMAL_TO_LIGHT takes normals from object space to light space:
+        glm::mat3 normal_to_light = normal_matrix(glm::mat3(object_to_light));
+        
+        for (uint32_t c = 0; c < 4; ++c) {
+            object.object_to_light[c] = glm::vec4(object_to_light[c], 0.0f);
+        }
+        for (uint32_t c = 0; c < 3; ++c) {
+            object.normal_to_light[c] = glm::vec4(normal_to_light[c], 0.0f);
+        }
+        
+        //only programs that use the Object block get a light list:
+        if (!drawable.pipeline.object_block) {
+            objects[i] = object;
+            continue;
+        }
+        
+        //the light list names the lights whose range reaches the drawable's bounds:
+        object.light_count = 0;
+        glm::vec3 center, extent;
+        bool bounded = world_bounds(drawable, &center, &extent);
+        for (uint32_t l = 0; l < uint32_t(light_data.size()) && object.light_count < int32_t(MaxDrawableLights); ++l) {
+            if (bounded && light_ranges[l] != std::numeric_limits<float>::infinity()) {
+                //distance from light to the closest point of the box:
+                glm::vec3 outside = glm::max(glm::abs(light_locations[l] - center) - extent, glm::vec3(0.0f));
+                if (glm::dot(outside, outside) > light_ranges[l] * light_ranges[l]) continue;
+            }
+            object.light_index[object.light_count / 4][object.light_count % 4] = int32_t(l);
+            object.light_count += 1;
         }
         
-        //NORMAL_TO_CLIP takes normals from object space to light space:
-        if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
-            glm::mat3 normal_to_light = glm::inverse(glm::transpose(glm::mat3(object_to_light)));
-            glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+        draw_stats.drawable_lights += uint32_t(object.light_count);
+        
+        std::memcpy(block_data + b * object_stride, &object, sizeof(ObjectData));
+        b += 1;
+    }
+    if (block_objects != 0) object_ring->unmap();
+    
+    
+    uint32_t block_index = 0;
+    
+    //Currently-bound state (0 == nothing bound yet):
+    GLuint current_program = 0;
+    GLuint current_vao = 0;
+    Drawable::Pipeline::TextureInfo current_textures[Drawable::Pipeline::TextureCount];
+    uint32_t current_active_texture = 0;
+    
+    //Send each drawable to OpenGL, only changing bindings when they differ from the previous drawable:
+    for (uint32_t i = 0; i < uint32_t(items.size()); ++i) {
+        Scene::Drawable const &drawable = *items[i].drawable;
+        Scene::Drawable::Pipeline const &pipeline = drawable.pipeline;
+        ObjectData const &object = objects[i];
+        
+        //Set shader program:
+        if (pipeline.program != current_program) {
+            glUseProgram(pipeline.program);
+            current_program = pipeline.program;
+            draw_stats.state_changes += 1;
+        } else {
+            draw_stats.state_changes_skipped += 1;
+        }
+        
+        //Set attribute sources:
+        if (pipeline.vao != current_vao) {
+            glBindVertexArray(pipeline.vao);
+            current_vao = pipeline.vao;
+            draw_stats.state_changes += 1;
+        } else {
+            draw_stats.state_changes_skipped += 1;
+        }
+        
+        //Configure program uniforms:
+        if (pipeline.object_block) {
+            //point the Object block at this drawable's slice of the ring:
+            glBindBufferRange(GL_UNIFORM_BUFFER, ObjectBinding, object_ring->buffer,
+                              objects_offset + GLintptr(block_index * object_stride), sizeof(ObjectData));
+            block_index += 1;
+        } else {
+            //..or set the individual uniforms:
+            if (pipeline.OBJECT_TO_CLIP_mat4 != -1U) {
+                glUniformMatrix4fv(pipeline.OBJECT_TO_CLIP_mat4, 1, GL_FALSE, glm::value_ptr(object.object_to_clip));
+            }
+            if (pipeline.OBJECT_TO_LIGHT_mat4x3 != -1U) {
+                glm::mat4x3 object_to_light = glm::mat4x3(
+                        glm::vec3(object.object_to_light[0]), glm::vec3(object.object_to_light[1]),
+                        glm::vec3(object.object_to_light[2]), glm::vec3(object.object_to_light[3])
+                );
+                glUniformMatrix4x3fv(pipeline.OBJECT_TO_LIGHT_mat4x3, 1, GL_FALSE, glm::value_ptr(object_to_light));
+            }
+            if (pipeline.NORMAL_TO_LIGHT_mat3 != -1U) {
+                glm::mat3 normal_to_light = glm::mat3(
+                        glm::vec3(object.normal_to_light[0]), glm::vec3(object.normal_to_light[1]),
+                        glm::vec3(object.normal_to_light[2])
+                );
+                glUniformMatrix3fv(pipeline.NORMAL_TO_LIGHT_mat3, 1, GL_FALSE, glm::value_ptr(normal_to_light));
+            }
         }
         
         //set any requested custom uniforms:
         if (pipeline.set_uniforms) pipeline.set_uniforms();
         
         //set up textures:
-        for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-            if (pipeline.textures[i].texture != 0) {
-                glActiveTexture(GL_TEXTURE0 + i);
-                glBindTexture(pipeline.textures[i].target, pipeline.textures[i].texture);
+        // (a texture left bound from an earlier drawable is harmless, since programs only sample the units they use)
+        for (uint32_t t = 0; t < Drawable::Pipeline::TextureCount; ++t) {
+            if (pipeline.textures[t].texture == 0) continue;
+            if (pipeline.textures[t].texture != current_textures[t].texture
+                || pipeline.textures[t].target != current_textures[t].target) {
+                if (current_active_texture != t) {
+                    glActiveTexture(GL_TEXTURE0 + t);
+                    current_active_texture = t;
+                }
+                //un-bind whatever was on this unit if it used a different target:
+                if (current_textures[t].texture != 0 && current_textures[t].target != pipeline.textures[t].target) {
+                    glBindTexture(current_textures[t].target, 0);
+                }
+                glBindTexture(pipeline.textures[t].target, pipeline.textures[t].texture);
+                current_textures[t] = pipeline.textures[t];
+                draw_stats.state_changes += 1;
+            } else {
+                draw_stats.state_changes_skipped += 1;
             }
         }
         
         //draw the object:
-        glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
-        
-        //un-bind textures:
-        for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
-            if (pipeline.textures[i].texture != 0) {
-                glActiveTexture(GL_TEXTURE0 + i);
-                glBindTexture(pipeline.textures[i].target, 0);
-            }
+        if (pipeline.instances == 1) {
+            glDrawArrays(pipeline.type, pipeline.start, pipeline.count);
+        } else {
+            glDrawArraysInstanced(pipeline.type, pipeline.start, pipeline.count, pipeline.instances);
+        }
+        draw_stats.draws += 1;
+    }
+    
+    //the ring can re-use this frame's Object blocks once the draws above are done with them:
+    if (block_objects != 0) object_ring->fence();
+    
+    //un-bind textures:
+    for (uint32_t i = 0; i < Drawable::Pipeline::TextureCount; ++i) {
+        if (current_textures[i].texture != 0) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(current_textures[i].target, 0);
         }
-        glActiveTexture(GL_TEXTURE0);
-        
     }
+    glActiveTexture(GL_TEXTURE0);
+    
+    draw_stats.world_matrix_updates = world_matrix_updates - world_matrix_updates_before;
     
     glUseProgram(0);
     glBindVertexArray(0);
@@ -172,10 +561,11 @@ void Scene::draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_lig
 void Scene::load(std::string const &filename,
                  std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable) {
     
-    std::ifstream file(filename, std::ios::binary);
+    //parse straight out of the (memory-mapped) file:
+    MappedFile file(filename);
+    char const *at = file.begin();
     
-    std::vector<char> names;
-    read_chunk(file, "str0", &names);
+    ChunkView<char> names = view_chunk<char>(&at, file.end(), "str0");
     
     struct HierarchyEntry {
         uint32_t parent;
@@ -186,8 +576,7 @@ void Scene::load(std::string const &filename,
         glm::vec3 scale;
     };
     static_assert(sizeof(HierarchyEntry) == 4 + 4 + 4 + 4 * 3 + 4 * 4 + 4 * 3, "HierarchyEntry is packed.");
-    std::vector<HierarchyEntry> hierarchy;
-    read_chunk(file, "xfh0", &hierarchy);
+    ChunkView<HierarchyEntry> hierarchy = view_chunk<HierarchyEntry>(&at, file.end(), "xfh0");
     
     struct MeshEntry {
         uint32_t transform;
@@ -195,8 +584,7 @@ void Scene::load(std::string const &filename,
         uint32_t name_end;
     };
     static_assert(sizeof(MeshEntry) == 4 + 4 + 4, "MeshEntry is packed.");
-    std::vector<MeshEntry> meshes;
-    read_chunk(file, "msh0", &meshes);
+    ChunkView<MeshEntry> meshes = view_chunk<MeshEntry>(&at, file.end(), "msh0");
     
     struct CameraEntry {
         uint32_t transform;
@@ -205,8 +593,7 @@ void Scene::load(std::string const &filename,
         float clip_near, clip_far;
     };
     static_assert(sizeof(CameraEntry) == 4 + 4 + 4 + 4 + 4, "CameraEntry is packed.");
-    std::vector<CameraEntry> loaded_cameras;
-    read_chunk(file, "cam0", &loaded_cameras);
+    ChunkView<CameraEntry> loaded_cameras = view_chunk<CameraEntry>(&at, file.end(), "cam0");
     
     struct LightEntry {
         uint32_t transform;
@@ -217,8 +604,7 @@ void Scene::load(std::string const &filename,
         float fov;
     };
     static_assert(sizeof(LightEntry) == 4 + 1 + 3 + 4 + 4 + 4, "LightEntry is packed.");
-    std::vector<LightEntry> loaded_lights;
-    read_chunk(file, "lmp0", &loaded_lights);
+    ChunkView<LightEntry> loaded_lights = view_chunk<LightEntry>(&at, file.end(), "lmp0");
     
     
     //--------------------------------
@@ -230,6 +616,7 @@ void Scene::load(std::string const &filename,
     for (auto const &h: hierarchy) {
         transforms.emplace_back();
         Transform *t = &transforms.back();
+        t->index = uint32_t(transforms.size() - 1);
         if (h.parent != -1U) {
             if (h.parent >= hierarchy_transforms.size()) {
                 throw std::runtime_error(
@@ -239,7 +626,7 @@ void Scene::load(std::string const &filename,
         }
         
         if (h.name_begin <= h.name_end && h.name_end <= names.size()) {
-            t->name = std::string(names.begin() + h.name_begin, names.begin() + h.name_end);
+            t->name = std::string(names.data + h.name_begin, names.data + h.name_end);
         } else {
             throw std::runtime_error(
                     "scene file '" + filename + "' contains hierarchy entry with invalid name indices");
@@ -262,7 +649,7 @@ void Scene::load(std::string const &filename,
         if (!(m.name_begin <= m.name_end && m.name_end <= names.size())) {
             throw std::runtime_error("scene file '" + filename + "' contains mesh entry with invalid name indices");
         }
-        std::string name = std::string(names.begin() + m.name_begin, names.begin() + m.name_end);
+        std::string name = std::string(names.data + m.name_begin, names.data + m.name_end);
         
         if (on_drawable) {
             on_drawable(*this, hierarchy_transforms[m.transform], name);
@@ -314,10 +701,17 @@ void Scene::load(std::string const &filename,
         light->spot_fov = l.fov / 180.0f * 3.1415926f; //FOV is stored in degrees; convert to radians.
     }
     
-    //load any extra that a subclass wants:
-    load_extra(file, names, hierarchy_transforms);
+    //load any extra that a subclass wants (reading the rest of the file through a stream):
+    struct MemoryBuffer : std::streambuf {
+        MemoryBuffer(char const *begin, char const *end) {
+            char *b = const_cast< char * >(begin); //(get area is only ever read)
+            setg(b, b, b + (end - begin));
+        }
+    } rest(at, file.end());
+    std::istream rest_stream(&rest);
+    load_extra(rest_stream, std::vector<char>(names.data, names.data + names.size()), hierarchy_transforms);
     
-    if (file.peek() != EOF) {
+    if (rest_stream.peek() != EOF) {
         std::cerr << "WARNING: trailing data in scene file '" << filename << "'" << std::endl;
     }
     
@@ -340,52 +734,115 @@ Scene &Scene::operator=(Scene const &other) {
     return *this;
 }
 
-void Scene::set(Scene const &other, std::unordered_map<Transform const *, Transform *> *transform_map_) {
+void Scene::set(Scene const &other, std::unordered_map<Transform const *, Transform *> *transform_map) {
+    if (&other == this) {
+        if (transform_map) {
+            transform_map->clear();
+            transform_map->insert(std::make_pair(nullptr, nullptr));
+            for (auto &t: transforms) {
+                transform_map->insert(std::make_pair(&t, &t));
+            }
+        }
+        return;
+    }
     
-    std::unordered_map<Transform const *, Transform *> t2t_temp;
-    std::unordered_map<Transform const *, Transform *> &transform_to_transform = *(transform_map_ ? transform_map_
-                                                                                                  : &t2t_temp);
+    //Resize transforms list to match, re-using existing transforms where possible:
+    // (so re-setting a scene from the same prototype -- e.g., on level restart -- doesn't allocate)
+    while (transforms.size() > other.transforms.size()) transforms.pop_back();
+    while (transforms.size() < other.transforms.size()) transforms.emplace_back();
+    
+    //Number other's transforms and pair them with transforms in this scene:
+    std::vector<Transform const *> other_transforms;
+    std::vector<Transform *> new_transforms;
+    other_transforms.reserve(other.transforms.size());
+    new_transforms.reserve(transforms.size());
+    {
+        auto t = transforms.begin();
+        for (auto const &o: other.transforms) {
+            other_transforms.emplace_back(&o);
+            new_transforms.emplace_back(&*t);
+            ++t;
+        }
+    }
     
-    transform_to_transform.clear();
+    //other's transforms sorted by address (along with their numbers), for transforms whose index is stale:
+    // (only built if needed; other is only read, so any number of threads can copy the same scene)
+    std::vector<std::pair<Transform const *, uint32_t> > numbers;
     
-    //null transform maps to itself:
-    transform_to_transform.insert(std::make_pair(nullptr, nullptr));
+    //other's transform -> this scene's transform, by number:
+    // (throws std::out_of_range, as the old hash-map lookup did, for transforms that aren't in other)
+    auto relink = [&numbers, &other_transforms, &new_transforms](Transform const *o) -> Transform * {
+        if (o == nullptr) return nullptr;
+        //usually the transform's index (from the load() or set() that made it) is still right:
+        if (o->index < other_transforms.size() && other_transforms[o->index] == o) return new_transforms[o->index];
+        
+        //..otherwise, look it up by address:
+        if (numbers.empty()) {
+            numbers.reserve(other_transforms.size());
+            for (uint32_t i = 0; i < uint32_t(other_transforms.size()); ++i) {
+                numbers.emplace_back(other_transforms[i], i);
+            }
+            std::sort(numbers.begin(), numbers.end());
+        }
+        auto found = std::lower_bound(numbers.begin(), numbers.end(), std::make_pair(o, uint32_t(0)));
+        if (found == numbers.end() || found->first != o) {
+            throw std::out_of_range("Scene::set: pointer to a transform that isn't in the scene being copied.");
+        }
+        return new_transforms[found->second];
+    };
     
-    //Copy transforms and store mapping:
-    transforms.clear();
-    for (auto const &t: other.transforms) {
-        transforms.emplace_back();
-        transforms.back().name = t.name;
-        transforms.back().position = t.position;
-        transforms.back().rotation = t.rotation;
-        transforms.back().scale = t.scale;
-        transforms.back().parent = t.parent; //will update later
+    //Copy transforms:
+    for (uint32_t i = 0; i < uint32_t(other_transforms.size()); ++i) {
+        Transform const &o = *other_transforms[i];
+        Transform &t = *new_transforms[i];
+        t.name = o.name;
+        t.position = o.position;
+        t.rotation = o.rotation;
+        t.scale = o.scale;
+        t.parent = relink(o.parent);
+        t.index = i;
         
-        //store mapping between transforms old and new:
-        auto ret = transform_to_transform.insert(std::make_pair(&t, &transforms.back()));
-        assert(ret.second);
+        //the copy starts with the same world matrices, so transforms that never move never recompute them:
+        t.cache = o.cache;
+        if (o.cache.parent == o.parent) {
+            t.cache.parent = t.parent;
+        } else {
+            t.cache.generation = 0; //out of date anyway
+        }
     }
     
-    //update transform parents:
-    for (auto &t: transforms) {
-        t.parent = transform_to_transform.at(t.parent);
+    if (transform_map) {
+        transform_map->clear();
+        transform_map->insert(std::make_pair(nullptr, nullptr));
+        for (uint32_t i = 0; i < uint32_t(other_transforms.size()); ++i) {
+            transform_map->insert(std::make_pair(other_transforms[i], new_transforms[i]));
+        }
     }
     
-    //copy other's drawables, updating transform pointers:
-    drawables = other.drawables;
-    for (auto &d: drawables) {
-        d.transform = transform_to_transform.at(d.transform);
+    //copy other's drawables (the ones it wants copied), updating transform pointers:
+    // (re-using existing list nodes)
+    auto d = drawables.begin();
+    for (auto const &o: other.drawables) {
+        if (!other.copy_drawable(o)) continue;
+        if (d == drawables.end()) {
+            d = drawables.insert(d, o);
+        } else {
+            *d = o;
+        }
+        d->transform = relink(o.transform);
+        ++d;
     }
+    drawables.erase(d, drawables.end());
     
     //copy other's cameras, updating transform pointers:
     cameras = other.cameras;
     for (auto &c: cameras) {
-        c.transform = transform_to_transform.at(c.transform);
+        c.transform = relink(c.transform);
     }
     
     //copy other's lights, updating transform pointers:
     lights = other.lights;
     for (auto &l: lights) {
-        l.transform = transform_to_transform.at(l.transform);
+        l.transform = relink(l.transform);
     }
 }
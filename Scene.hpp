@@ -16,6 +16,7 @@
 #include <glm/gtc/quaternion.hpp>
 
 #include <list>
+#include <limits>
 #include <memory>
 #include <functional>
 #include <string>
@@ -42,6 +43,9 @@ struct Scene {
         glm::mat4x3 make_parent_to_local() const;
         
         // ..relative to the world:
+        // (these are cached; see 'cache' below)
+        //NOTE: even though these are const, they update the caches of the transform and its ancestors,
+        // so a transform hierarchy must only be used from one thread at a time.
         glm::mat4x3 make_local_to_world() const;
         
         glm::mat4x3 make_world_to_local() const;
@@ -51,6 +55,51 @@ struct Scene {
         
         //if we delete some constructors, we need to let the compiler know that the default constructor is still okay:
         Transform() = default;
+        
+        //While a Frozen is alive (e.g., during Scene::draw), transforms on its thread are assumed not to change,
+        // so each cache is only checked against its transform once:
+        // (freezing while already frozen does nothing; the outermost Frozen thaws)
+        struct Frozen {
+            Frozen();
+            
+            ~Frozen();
+            
+            Frozen(Frozen const &) = delete;
+            
+            Frozen &operator=(Frozen const &) = delete;
+            
+            bool froze; //did this Frozen start the freeze?
+        };
+        
+        //-- internals ---
+        
+        //World matrices are cached along with the local values they were computed from.
+        // Any change to position/rotation/scale/parent (or to an ancestor) shows up as a mismatch
+        // on the next call, so code can keep writing these members directly.
+        // (this skips recomputing matrices that didn't change, but checking still compares every transform used)
+        struct Cache {
+            glm::vec3 position = glm::vec3(std::numeric_limits<float>::quiet_NaN()); //NaN never compares equal
+            glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+            glm::vec3 scale = glm::vec3(1.0f, 1.0f, 1.0f);
+            Transform const *parent = nullptr;
+            uint32_t parent_generation = 0; //parent's generation when local_to_world was computed
+            
+            uint32_t generation = 0; //unique id for the current local_to_world (0 == never computed)
+            uint32_t world_to_local_generation = 0; //generation that world_to_local was computed for
+            uint32_t epoch = 0; //freeze epoch in which this cache was last checked
+            
+            glm::mat4x3 local_to_world = glm::mat4x3(1.0f);
+            glm::mat4x3 world_to_local = glm::mat4x3(1.0f);
+        };
+        mutable Cache cache;
+        
+        //bring cache.local_to_world up to date (checks ancestors first):
+        void update_cache() const;
+        
+        //position in its scene's transforms list, as of the load() or set() that made it:
+        // (only ever written by the scene that owns the transform; Scene::set checks it before trusting it,
+        //  so it's fine for it to go stale when transforms are added or removed by hand)
+        uint32_t index = -1U;
     };
     
     struct Drawable {
@@ -69,12 +118,17 @@ struct Scene {
             GLenum type = GL_TRIANGLES; //what sort of primitive to draw; passed to glDrawArrays
             GLuint start = 0; //first vertex to draw; passed to glDrawArrays
             GLuint count = 0; //number of vertices to draw; passed to glDrawArrays
+            GLuint instances = 1; //number of instances to draw; anything but 1 uses glDrawArraysInstanced
             
             //uniforms:
             GLuint OBJECT_TO_CLIP_mat4 = -1U; //uniform location for object to clip space matrix
             GLuint OBJECT_TO_LIGHT_mat4x3 = -1U; //uniform location for object to light space (== world space) matrix
             GLuint NORMAL_TO_LIGHT_mat3 = -1U; //uniform location for normal to light space (== world space) matrix
             
+            //programs may instead read all of the above (and a light list) from an Object uniform block:
+            // (see ObjectData below; this is much cheaper than setting the uniforms for every drawable)
+            bool object_block = false;
+            
             std::function<void()> set_uniforms; //(optional) function to set any other useful uniforms
             
             //texture objects to bind for the first TextureCount textures:
@@ -85,7 +139,16 @@ struct Scene {
                 GLuint texture = 0;
                 GLenum target = GL_TEXTURE_2D;
             } textures[TextureCount];
+            
+            //draw() sorts drawables by (layer, program, vao, textures, type) to avoid redundant state changes;
+            // use a higher layer for things that must be drawn after others (e.g., alpha-blended text):
+            uint32_t layer = 0;
         } pipeline;
+        
+        //local-space bounding box (e.g., Mesh::min and Mesh::max), used by draw() to skip drawables outside the view:
+        // (the default, empty box means "no bounds", and such drawables are never culled)
+        glm::vec3 min = glm::vec3(std::numeric_limits<float>::infinity());
+        glm::vec3 max = glm::vec3(-std::numeric_limits<float>::infinity());
     };
     
     struct Camera {
@@ -125,6 +188,39 @@ struct Scene {
         float spot_fov = glm::radians(45.0f); //spot cone fov (in radians)
     };
     
+    //draw() uploads lights to programs through a uniform block (std140 layout):
+    // layout(std140) uniform Lights { LightData LIGHTS[MaxLights]; };
+    //and tells each drawable which of them to evaluate through the light list in its Object block (below)
+    enum : uint32_t {
+        LightsBinding = 0, //uniform buffer binding point for the Lights block
+        ObjectBinding = 1, //uniform buffer binding point for the Object block
+        MaxLights = 64, //lights beyond this many are ignored
+        MaxDrawableLights = 8 //lights beyond this many (per drawable) are ignored
+    };
+    struct LightData {
+        glm::vec4 location_type; //light space location; w is type (0 - point, 1 - hemisphere, 2 - spot, 3 - directional)
+        glm::vec4 direction_cutoff; //light space direction; w is cosine of half the spot cone fov
+        glm::vec4 energy; //w unused
+    };
+    static_assert(sizeof(LightData) == 3 * 4 * 4, "LightData matches std140 layout.");
+    
+    //Per-drawable uniforms, for programs with pipeline.object_block set (std140 layout):
+    // layout(std140) uniform Object {
+    //     mat4 OBJECT_TO_CLIP; mat4x3 OBJECT_TO_LIGHT; mat3 NORMAL_TO_LIGHT;
+    //     ivec4 LIGHT_INDEX[MaxDrawableLights / 4]; int LIGHT_COUNT;
+    // };
+    //draw() streams these for all drawables into one buffer and binds each drawable's slice in turn.
+    struct ObjectData {
+        glm::mat4 object_to_clip;
+        glm::vec4 object_to_light[4]; //mat4x3 columns (std140 pads each to a vec4)
+        glm::vec4 normal_to_light[3]; //mat3 columns (also padded)
+        glm::ivec4 light_index[MaxDrawableLights / 4];
+        int32_t light_count;
+        int32_t padding[3];
+    };
+    static_assert(sizeof(ObjectData) == 4 * 4 * 4 + 4 * 4 * 4 + 3 * 4 * 4 + 2 * 4 * 4 + 4 * 4,
+                  "ObjectData matches std140 layout.");
+    
     //Scenes, of course, may have many of the above objects:
     std::list<Transform> transforms;
     std::list<Drawable> drawables;
@@ -132,11 +228,28 @@ struct Scene {
     std::list<Light> lights;
     
     //The "draw" function provides a convenient way to pass all the things in a scene to OpenGL:
+    // (drawables whose bounds lie outside the view are skipped)
     void draw(Camera const &camera) const;
     
     //..sometimes, you want to draw with a custom projection matrix and/or light space:
     void draw(glm::mat4 const &world_to_clip, glm::mat4x3 const &world_to_light = glm::mat4x3(1.0f)) const;
     
+    //free the GL objects draw() shares between all scenes (call from main.cpp before the GL context goes away):
+    static void release_gl();
+    
+    //counts from the most recent draw() call:
+    struct DrawStats {
+        uint32_t draws = 0; //draw calls issued
+        uint32_t state_changes = 0; //program/vao/texture bindings changed
+        uint32_t state_changes_skipped = 0; //bindings skipped because the previous drawable used the same state
+        uint32_t visible = 0; //drawables inside the view frustum (or without bounds)
+        uint32_t culled = 0; //drawables skipped because their bounds were outside the view frustum
+        uint32_t lights = 0; //lights uploaded
+        uint32_t drawable_lights = 0; //total (drawable, light) pairs that passed the light-vs-bounds test
+        uint32_t world_matrix_updates = 0; //world matrices recomputed (because their transform or an ancestor moved)
+    };
+    mutable DrawStats draw_stats;
+    
     //add transforms/objects/cameras from a scene file to this scene:
     // the 'on_drawable' callback gives your code a chance to look up mesh data and make Drawables:
     // throws on file format errors
@@ -156,8 +269,15 @@ struct Scene {
           std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable);
     
     //copy a scene (with proper pointer fixup):
+    // (copies leave out drawables that copy_drawable() says no to)
     Scene(Scene const &); //...as a constructor
     Scene &operator=(Scene const &); //...as scene = scene
     //... as a set() function that optionally returns the transform->transform mapping:
+    // (transforms and other objects already in this scene are re-used rather than re-allocated,
+    //  and world matrices come along with their transforms, so re-setting from a prototype is cheap)
     void set(Scene const &, std::unordered_map<Transform const *, Transform *> *transform_map = nullptr);
+    
+    //should copies of this scene get this drawable? Subclasses that attach drawables to transforms outside of
+    // 'transforms' (which copies couldn't relink) say no to those:
+    virtual bool copy_drawable(Drawable const &drawable) const { return true; }
 };
@@ -1,11 +1,17 @@
 #include "Sound.hpp"
 #include "load_wav.hpp"
 #include "load_opus.hpp"
+#include "mix_span.hpp"
 
 #include <SDL.h>
 
-#include <list>
+#include <array>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include <exception>
 #include <iostream>
 #include <algorithm>
@@ -16,12 +22,110 @@ namespace {
     //handy constants:
     constexpr uint32_t const AUDIO_RATE = 48000; //sampling rate
     constexpr uint32_t const MIX_SAMPLES = 1024; //number of samples to mix per call of mix_audio callback; n.b. SDL requires this to be a power of two
+    constexpr uint32_t const MAX_PLAYING_SAMPLES = 1024; //samples mixed at once; samples played beyond this are dropped
+    constexpr uint32_t const COMMAND_COUNT = 4096; //size of the command ring (power of two, so indices wrap cleanly)
+    constexpr uint32_t const STREAM_SAMPLES = 32768; //decoded-ahead audio per streamed sample (~0.7s; power of two)
     
     //The audio device:
     SDL_AudioDeviceID device = 0;
     
-    //list of all currently playing samples:
-    std::list<std::shared_ptr<Sound::PlayingSample> > playing_samples;
+    //Changes made by the game thread, waiting for the audio thread to apply them:
+    struct Command {
+        enum Type : uint8_t {
+            Play, SetVolume, SetPan, SetPosition, SetHalfVolumeRadius, Stop, StopAll, SetGlobalVolume, SetListener
+        } type = Play;
+        std::shared_ptr<Sound::PlayingSample> sample; //sample being changed (if any)
+        float ramp = 0.0f;
+        glm::vec3 value = glm::vec3(0.0f); //new value (in .x for single values; listener position for SetListener)
+        glm::vec3 right = glm::vec3(0.0f); //new listener right (SetListener only)
+    };
+    
+    //Commands travel through a single-producer / single-consumer ring:
+    // only the game thread advances 'commands_head' (after writing a slot),
+    // only the audio thread advances 'commands_tail' (after reading slots), at the start of each mix_audio call,
+    // so neither needs a lock, and neither ever waits for the other.
+    //Slots hang on to their command's sample until the game thread reuses them, so samples are never freed
+    // by the audio thread (and are never freed while a command the audio thread hasn't read points to them).
+    std::array<Command, COMMAND_COUNT> commands;
+    std::atomic<uint32_t> commands_head(0); //next slot to write (counts up forever; slot is index % COMMAND_COUNT)
+    std::atomic<uint32_t> commands_tail(0); //next slot to read
+    
+    //commands that didn't fit in the ring (game thread only; sent ahead of the next command):
+    std::vector<Command> overflow;
+    
+    //samples the audio thread may be playing, kept alive until it reports them stopped (game thread only):
+    std::vector<std::shared_ptr<Sound::PlayingSample> > playing_samples;
+    //how many samples the audio thread has stopped so far (counts up forever), so the game thread can tell whether
+    // any of playing_samples are done without looking at each one:
+    std::atomic<uint32_t> stopped_count(0);
+    uint32_t pruned_count = 0; //stopped_count as of the last prune() (game thread only)
+    
+    //samples the audio thread is playing (audio thread only; reserved in init, so mixing never allocates):
+    std::vector<Sound::PlayingSample *> mixing;
+    
+    //Streamed samples are decoded on this thread, which tops up each one's StreamBuffer every few milliseconds:
+    std::thread decoder;
+    std::mutex decoder_mutex; //guards decoder_streams and decoder_quit (never taken by the audio thread)
+    std::condition_variable decoder_wake;
+    std::vector<std::shared_ptr<Sound::PlayingSample> > decoder_streams; //just started, for the decoder to pick up
+    bool decoder_quit = false;
+    
+    //game thread: put a command in the ring, if there's room
+    bool try_push(Command &&command) {
+        uint32_t head = commands_head.load(std::memory_order_relaxed);
+        if (head - commands_tail.load(std::memory_order_acquire) == COMMAND_COUNT) return false; //full
+        commands[head % COMMAND_COUNT] = std::move(command);
+        commands_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    
+    //game thread: forget samples the audio thread is done with (just one atomic load unless some have stopped)
+    void prune() {
+        uint32_t count = stopped_count.load(std::memory_order_acquire);
+        if (count == pruned_count) return;
+        pruned_count = count;
+        playing_samples.erase(std::remove_if(playing_samples.begin(), playing_samples.end(),
+                                             [](std::shared_ptr<Sound::PlayingSample> const &s) {
+                                                 return s->stopped.load(std::memory_order_acquire);
+                                             }), playing_samples.end());
+    }
+    
+    //game thread: send a command (in order after any earlier ones)
+    // (also lets go of finished samples, so they're freed promptly as long as the game sends anything at all)
+    void push(Command command) {
+        if (device == 0) return; //no audio thread to send it to
+        
+        prune();
+        
+        size_t sent = 0;
+        while (sent < overflow.size() && try_push(std::move(overflow[sent]))) {
+            ++sent;
+        }
+        overflow.erase(overflow.begin(), overflow.begin() + sent);
+        
+        if (!overflow.empty() || !try_push(std::move(command))) {
+            overflow.emplace_back(std::move(command));
+        }
+    }
+    
+    //game thread: register and start a new playing sample
+    std::shared_ptr<Sound::PlayingSample> start(Sound::Sample const &sample,
+                                                std::shared_ptr<Sound::PlayingSample> const &playing_sample) {
+        if (device == 0) return playing_sample;
+        
+        //streamed samples get decoding before they get mixed (the mixer waits for the first samples to show up):
+        if (!sample.stream_filename.empty()) {
+            playing_sample->stream = std::make_shared<Sound::StreamBuffer>(sample.stream_filename);
+            std::lock_guard<std::mutex> lock(decoder_mutex);
+            decoder_streams.emplace_back(playing_sample);
+            decoder_wake.notify_one();
+        }
+        
+        //(push() forgets samples the audio thread is done with)
+        playing_samples.emplace_back(playing_sample);
+        push(Command{Command::Play, playing_sample});
+        return playing_sample;
+    }
     
 }
 
@@ -33,9 +137,26 @@ Sound::Ramp<float> Sound::volume = Sound::Ramp<float>(1.0f);
 //global listener information:
 Sound::Listener Sound::listener;
 
+//Streamed samples are played from these: written by the decoder thread and read by the audio thread, with
+// only 'written' and 'read' shared, so (like the command ring) neither waits on the other:
+struct Sound::StreamBuffer {
+    explicit StreamBuffer(std::string const &filename_) : filename(filename_) {}
+    
+    std::string filename;
+    std::unique_ptr<OpusStream> opus; //opened by the decoder thread (and only used there)
+    
+    std::vector<float> ring = std::vector<float>(STREAM_SAMPLES); //decoded samples, at (count % STREAM_SAMPLES)
+    std::atomic<uint32_t> written{0}; //samples decoded into ring so far (counts up forever)
+    std::atomic<uint32_t> read{0}; //samples mixed out of ring so far
+    std::atomic<bool> ended{false}; //has decoding finished? (playback is done once read catches up to written)
+};
+
 //This audio-mixing callback is defined below:
 void mix_audio(void *, Uint8 *buffer_, int len);
 
+//This decoding loop (run by the 'decoder' thread) is also defined below:
+void decode_streams();
+
 //------------------------ public-facing --------------------------------
 
 Sound::Sample::Sample(std::string const &filename) {
@@ -52,6 +173,14 @@ Sound::Sample::Sample(std::string const &filename) {
 Sound::Sample::Sample(std::vector<float> const &data_) : data(data_) {
 }
 
+Sound::Sample::Sample(std::string const &filename, StreamTag) : stream_filename(filename) {
+    if (!(filename.size() >= 5 && filename.substr(filename.size() - 5) == ".opus")) {
+        throw std::runtime_error("Sample '" + filename + R"(' doesn't end in ".opus" -- unsure how to stream.)");
+    }
+    //open it once now, so a missing or broken file is reported here instead of when it's played:
+    OpusStream check(filename);
+}
+
 
 void Sound::init() {
     if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0) {
@@ -60,6 +189,10 @@ void Sound::init() {
         return;
     }
     
+    //pick a mixing kernel and make room for samples now, rather than in the audio callback:
+    MixKernel const &mix_kernel = select_mix_kernel();
+    mixing.reserve(MAX_PLAYING_SAMPLES);
+    
     //Based on the example on https://wiki.libsdl.org/SDL_OpenAudioDevice
     SDL_AudioSpec want, have;
     SDL_zero(want);
@@ -74,13 +207,19 @@ void Sound::init() {
         std::cerr << "Failed to open audio device:\n" << SDL_GetError() << std::endl;
         std::cerr << "  (Will continue without audio.)\n" << std::endl;
     } else {
-        //start audio playback:
+        //start decoding streamed samples (none yet) and audio playback:
+        decoder_quit = false;
+        decoder = std::thread(decode_streams);
         SDL_PauseAudioDevice(device, 0);
-        std::cout << "Audio output initialized." << std::endl;
+        std::cout << "Audio output initialized (mixing with " << mix_kernel.name << ")." << std::endl;
     }
 }
 
 
+void Sound::update() {
+    prune();
+}
+
 void Sound::shutdown() {
     if (device != 0) {
         //stop audio playback:
@@ -88,130 +227,85 @@ void Sound::shutdown() {
         SDL_CloseAudioDevice(device);
         device = 0;
     }
+    if (decoder.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(decoder_mutex);
+            decoder_quit = true;
+        }
+        decoder_wake.notify_one();
+        decoder.join();
+    }
+    //(the audio and decoder threads are gone, so nothing else is looking at these)
+    decoder_streams.clear();
+    mixing.clear();
+    overflow.clear();
+    playing_samples.clear();
 }
 
 
-void Sound::lock() {
-    if (device) SDL_LockAudioDevice(device);
-}
-
-void Sound::unlock() {
-    if (device) SDL_UnlockAudioDevice(device);
-}
-
 std::shared_ptr<Sound::PlayingSample> Sound::play(Sample const &sample, float play_volume, float pan) {
-    std::shared_ptr<Sound::PlayingSample> playing_sample = std::make_shared<Sound::PlayingSample>(sample, play_volume,
-                                                                                                  pan, false);
-    lock();
-    playing_samples.emplace_back(playing_sample);
-    unlock();
-    return playing_sample;
+    return start(sample, std::make_shared<Sound::PlayingSample>(sample, play_volume, pan, false));
 }
 
 std::shared_ptr<Sound::PlayingSample>
 Sound::play_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-    std::shared_ptr<Sound::PlayingSample> playing_sample = std::make_shared<Sound::PlayingSample>(sample, play_volume,
-                                                                                                  position,
-                                                                                                  half_volume_radius,
-                                                                                                  false);
-    lock();
-    playing_samples.emplace_back(playing_sample);
-    unlock();
-    return playing_sample;
+    return start(sample,
+                 std::make_shared<Sound::PlayingSample>(sample, play_volume, position, half_volume_radius, false));
 }
 
 std::shared_ptr<Sound::PlayingSample> Sound::loop(Sample const &sample, float play_volume, float pan) {
-    std::shared_ptr<Sound::PlayingSample> playing_sample = std::make_shared<Sound::PlayingSample>(sample, play_volume,
-                                                                                                  pan, true);
-    lock();
-    playing_samples.emplace_back(playing_sample);
-    unlock();
-    return playing_sample;
+    return start(sample, std::make_shared<Sound::PlayingSample>(sample, play_volume, pan, true));
 }
 
 
 std::shared_ptr<Sound::PlayingSample>
 Sound::loop_3D(Sample const &sample, float play_volume, glm::vec3 const &position, float half_volume_radius) {
-    std::shared_ptr<Sound::PlayingSample> playing_sample = std::make_shared<Sound::PlayingSample>(sample, play_volume,
-                                                                                                  position,
-                                                                                                  half_volume_radius,
-                                                                                                  true);
-    lock();
-    playing_samples.emplace_back(playing_sample);
-    unlock();
-    return playing_sample;
+    return start(sample,
+                 std::make_shared<Sound::PlayingSample>(sample, play_volume, position, half_volume_radius, true));
 }
 
 
 void Sound::stop_all_samples() {
-    lock();
-    for (auto &s: playing_samples) {
-        s->stop();
-    }
-    unlock();
+    push(Command{Command::StopAll, nullptr, 1.0f / 60.0f});
 }
 
 void Sound::set_volume(float new_volume, float ramp) {
-    lock();
-    volume.set(new_volume, ramp);
-    unlock();
+    push(Command{Command::SetGlobalVolume, nullptr, ramp, glm::vec3(new_volume)});
 }
 
 //------------------
+//(these just queue the change; the audio thread checks if it applies -- e.g., if the sample is in '2D' mode --
+// when it gets to it, since only it may look at the sample's state)
 
 void Sound::PlayingSample::set_volume(float new_volume, float ramp) {
-    Sound::lock();
-    if (!stopping) {
-        volume.set(new_volume, ramp);
-    }
-    Sound::unlock();
+    push(Command{Command::SetVolume, shared_from_this(), ramp, glm::vec3(new_volume)});
 }
 
 void Sound::PlayingSample::set_pan(float new_pan, float ramp) {
-    if (std::isnan(pan.value)) return; //ignore if not in '2D' mode
-    Sound::lock();
-    pan.set(new_pan, ramp);
-    Sound::unlock();
+    push(Command{Command::SetPan, shared_from_this(), ramp, glm::vec3(new_pan)});
 }
 
 void Sound::PlayingSample::set_position(glm::vec3 const &new_position, float ramp) {
-    if (!std::isnan(pan.value)) return; //ignore if not in '3D' mode
-    Sound::lock();
-    position.set(new_position, ramp);
-    Sound::unlock();
+    push(Command{Command::SetPosition, shared_from_this(), ramp, new_position});
 }
 
 void Sound::PlayingSample::set_half_volume_radius(float new_radius, float ramp) {
-    if (!std::isnan(pan.value)) return; //ignore if not in '3D' mode
-    Sound::lock();
-    half_volume_radius.set(new_radius, ramp);
-    Sound::unlock();
+    push(Command{Command::SetHalfVolumeRadius, shared_from_this(), ramp, glm::vec3(new_radius)});
 }
 
 void Sound::PlayingSample::stop(float ramp) {
-    Sound::lock();
-    if (!(stopping || stopped)) {
-        stopping = true;
-        volume.target = 0.0f;
-        volume.ramp = ramp;
-    } else {
-        volume.ramp = std::min(volume.ramp, ramp);
-    }
-    Sound::unlock();
+    push(Command{Command::Stop, shared_from_this(), ramp});
 }
 
 //------------------
 
 void Sound::Listener::set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp) {
-    Sound::lock();
-    position.set(new_position, ramp);
     //some extra code to make sure right is always a unit vector:
-    if (new_right == glm::vec3(0.0f)) {
-        right.set(glm::vec3(1.0f, 0.0f, 0.0f), ramp);
-    } else {
-        right.set(glm::normalize(new_right), ramp);
+    glm::vec3 unit_right = glm::vec3(1.0f, 0.0f, 0.0f);
+    if (new_right != glm::vec3(0.0f)) {
+        unit_right = glm::normalize(new_right);
     }
-    Sound::unlock();
+    push(Command{Command::SetListener, nullptr, ramp, new_position, unit_right});
 }
 
 //------------------------ internals --------------------------------
@@ -318,6 +412,71 @@ void step_direction_ramp(Sound::Ramp<glm::vec3> &ramp) {
     }
 }
 
+//helper: fade a playing sample out (audio thread):
+void stop_playing_sample(Sound::PlayingSample &playing_sample, float ramp) {
+    if (!playing_sample.stopping) {
+        playing_sample.stopping = true;
+        playing_sample.volume.target = 0.0f;
+        playing_sample.volume.ramp = ramp;
+    } else {
+        playing_sample.volume.ramp = std::min(playing_sample.volume.ramp, ramp);
+    }
+}
+
+//helper: apply a command from the game thread (audio thread):
+void apply_command(Command const &command) {
+    //(the slot holds a reference, so this stays valid until the ring moves past the command)
+    Sound::PlayingSample *playing_sample = command.sample.get();
+    if (command.type == Command::Play) {
+        if (mixing.size() < MAX_PLAYING_SAMPLES) {
+            mixing.emplace_back(playing_sample);
+        } else {
+            playing_sample->stopped.store(true, std::memory_order_release); //no room; drop it
+            stopped_count.fetch_add(1, std::memory_order_release);
+        }
+        return;
+    }
+    //changes to samples that already finished don't matter:
+    if (playing_sample && playing_sample->stopped.load(std::memory_order_relaxed)) return;
+    
+    switch (command.type) {
+        case Command::Play:
+            break;
+        case Command::SetVolume:
+            if (!playing_sample->stopping) {
+                playing_sample->volume.set(command.value.x, command.ramp);
+            }
+            break;
+        case Command::SetPan:
+            if (std::isnan(playing_sample->pan.value)) break; //ignore if not in '2D' mode
+            playing_sample->pan.set(command.value.x, command.ramp);
+            break;
+        case Command::SetPosition:
+            if (!std::isnan(playing_sample->pan.value)) break; //ignore if not in '3D' mode
+            playing_sample->position.set(command.value, command.ramp);
+            break;
+        case Command::SetHalfVolumeRadius:
+            if (!std::isnan(playing_sample->pan.value)) break; //ignore if not in '3D' mode
+            playing_sample->half_volume_radius.set(command.value.x, command.ramp);
+            break;
+        case Command::Stop:
+            stop_playing_sample(*playing_sample, command.ramp);
+            break;
+        case Command::StopAll:
+            for (Sound::PlayingSample *s: mixing) {
+                stop_playing_sample(*s, command.ramp);
+            }
+            break;
+        case Command::SetGlobalVolume:
+            Sound::volume.set(command.value.x, command.ramp);
+            break;
+        case Command::SetListener:
+            Sound::listener.position.set(command.value, command.ramp);
+            Sound::listener.right.set(command.right, command.ramp);
+            break;
+    }
+}
+
 
 //The audio callback -- invoked by SDL when it needs more sound to play:
 void mix_audio(void *, Uint8 *buffer_, int len) {
@@ -337,6 +496,14 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
         buffer[s].r = 0.0f;
     }
     
+    //apply everything the game thread has sent since the last call:
+    uint32_t head = commands_head.load(std::memory_order_acquire);
+    uint32_t tail = commands_tail.load(std::memory_order_relaxed);
+    for (; tail != head; ++tail) {
+        apply_command(commands[tail % COMMAND_COUNT]);
+    }
+    commands_tail.store(tail, std::memory_order_release);
+    
     //update global values:
     float start_volume = Sound::volume.value;
     glm::vec3 start_position = Sound::listener.position.value;
@@ -351,8 +518,10 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
     glm::vec3 end_right = Sound::listener.right.value;
     
     //add audio from each playing sample into the buffer:
-    for (auto si = playing_samples.begin(); si != playing_samples.end(); /* later */) {
-        Sound::PlayingSample &playing_sample = **si; //much more convenient than writing ** everywhere.
+    //(finished samples are dropped by moving the rest down over them)
+    size_t kept = 0;
+    for (size_t si = 0; si < mixing.size(); ++si) {
+        Sound::PlayingSample &playing_sample = *mixing[si]; //much more convenient than writing * everywhere.
         
         //Figure out sample panning/volume at start...
         LR start_pan;
@@ -395,53 +564,137 @@ void mix_audio(void *, Uint8 *buffer_, int len) {
         end_pan.r *= end_volume * playing_sample.volume.value;
         
         //figure out a step to add at each sample so that pan will move smoothly from start to end:
-        LR pan = start_pan;
         LR pan_step;
         pan_step.l = (end_pan.l - start_pan.l) / MIX_SAMPLES;
         pan_step.r = (end_pan.r - start_pan.r) / MIX_SAMPLES;
         
-        assert(playing_sample.i < playing_sample.data.size());
-        
-        for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
-            //mix one sample based on current pan values:
-            buffer[i].l += pan.l * playing_sample.data[playing_sample.i];
-            buffer[i].r += pan.r * playing_sample.data[playing_sample.i];
+        bool finished; //has the sample run out?
+        if (playing_sample.stream) {
+            //streamed: mix whatever the decoder has ready (spans break where the ring wraps),
+            Sound::StreamBuffer &stream = *playing_sample.stream;
+            bool ended = stream.ended.load(std::memory_order_acquire); //(read before 'written', so it's final if set)
+            uint32_t written = stream.written.load(std::memory_order_acquire);
+            uint32_t read = stream.read.load(std::memory_order_relaxed);
+            for (uint32_t mixed = 0; mixed < MIX_SAMPLES && read != written; /* later */) {
+                uint32_t at = read % STREAM_SAMPLES;
+                uint32_t count = std::min({MIX_SAMPLES - mixed, written - read, STREAM_SAMPLES - at});
+                mix_span(stream.ring.data() + at, count, reinterpret_cast< float * >(buffer + mixed),
+                         start_pan.l + float(mixed) * pan_step.l, start_pan.r + float(mixed) * pan_step.r,
+                         pan_step.l, pan_step.r);
+                mixed += count;
+                read += count;
+            }
+            //...and hand the space back to the decoder:
+            stream.read.store(read, std::memory_order_release);
+            //(if the decoder fell behind, the rest of this block is silent for this sample)
+            finished = ended && read == written;
+        } else {
+            assert(playing_sample.i < playing_sample.data.size());
             
-            //update position in sample:
-            playing_sample.i += 1;
-            if (playing_sample.i == playing_sample.data.size()) {
-                if (playing_sample.loop) {
-                    playing_sample.i = 0;
-                } else {
-                    break;
+            //mix in contiguous spans, each running up to the end of the buffer or of the sample data (where it loops):
+            for (uint32_t mixed = 0; mixed < MIX_SAMPLES; /* later */) {
+                uint32_t count = std::min(MIX_SAMPLES - mixed, uint32_t(playing_sample.data.size() - playing_sample.i));
+                mix_span(playing_sample.data.data() + playing_sample.i, count,
+                         reinterpret_cast< float * >(buffer + mixed),
+                         start_pan.l + float(mixed) * pan_step.l, start_pan.r + float(mixed) * pan_step.r,
+                         pan_step.l, pan_step.r);
+                mixed += count;
+                
+                //update position in sample:
+                playing_sample.i += count;
+                if (playing_sample.i == playing_sample.data.size()) {
+                    if (playing_sample.loop) {
+                        playing_sample.i = 0;
+                    } else {
+                        break;
+                    }
                 }
             }
-            
-            //update pan values:
-            pan.l += pan_step.l;
-            pan.r += pan_step.r;
+            finished = playing_sample.i >= playing_sample.data.size();
         }
         
-        if (playing_sample.i >= playing_sample.data.size()
-            || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
-            playing_sample.stopped = true;
-            //erase from list:
-            auto old = si;
-            ++si;
-            playing_samples.erase(old);
+        if (finished || (playing_sample.stopping && playing_sample.volume.value == 0.0f)) { //sample has finished
+            //(the last time this thread touches it; the game thread may let it go after this)
+            playing_sample.stopped.store(true, std::memory_order_release);
+            stopped_count.fetch_add(1, std::memory_order_release);
         } else {
-            ++si;
+            mixing[kept++] = &playing_sample;
         }
     }
+    mixing.resize(kept);
     
     /*//DEBUG: report output power:
     float max_power = 0.0f;
     for (uint32_t s = 0; s < MIX_SAMPLES; ++s) {
         max_power = std::max(max_power, (buffer[s].l * buffer[s].l + buffer[s].r * buffer[s].r));
     }
-    std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << playing_samples.size() << std::endl; //DEBUG
+    std::cout << "Max Power: " << std::sqrt(max_power) << "; playing samples: " << mixing.size() << std::endl; //DEBUG
     */
     
 }
 
+//helper: decode a streamed sample as far ahead as its ring has room for (decoder thread):
+void decode_ahead(Sound::PlayingSample &playing_sample) {
+    Sound::StreamBuffer &stream = *playing_sample.stream;
+    try {
+        if (!stream.opus) stream.opus = std::make_unique<OpusStream>(stream.filename);
+        
+        uint32_t written = stream.written.load(std::memory_order_relaxed);
+        for (;;) {
+            uint32_t room = STREAM_SAMPLES - (written - stream.read.load(std::memory_order_acquire));
+            if (room == 0) break; //full; the mixer needs to catch up
+            uint32_t at = written % STREAM_SAMPLES;
+            uint32_t count = stream.opus->read(stream.ring.data() + at, std::min(room, STREAM_SAMPLES - at));
+            if (count == 0) { //end of file
+                //looping carries straight on from the start (unless there's nothing in the file at all):
+                if (playing_sample.loop && written != 0) {
+                    stream.opus->rewind();
+                    continue;
+                }
+                stream.ended.store(true, std::memory_order_release);
+                break;
+            }
+            written += count;
+            //publish the new samples to the mixer:
+            stream.written.store(written, std::memory_order_release);
+        }
+    } catch (std::exception &e) {
+        std::cerr << "Stopped streaming '" << stream.filename << "': " << e.what() << std::endl;
+        stream.ended.store(true, std::memory_order_release);
+    }
+}
 
+//The decoder thread's loop:
+void decode_streams() {
+    std::vector<std::shared_ptr<Sound::PlayingSample> > streams; //ones this thread is decoding
+    for (;;) {
+        {
+            //wait (a little) for new streams -- playing ones need topping up every MIX_SAMPLES or so anyway:
+            std::unique_lock<std::mutex> lock(decoder_mutex);
+            decoder_wake.wait_for(lock, std::chrono::milliseconds(5), []() {
+                return decoder_quit || !decoder_streams.empty();
+            });
+            if (decoder_quit) break;
+            streams.insert(streams.end(), decoder_streams.begin(), decoder_streams.end());
+            decoder_streams.clear();
+        }
+        
+        for (auto const &playing_sample: streams) {
+            if (playing_sample->stopped.load(std::memory_order_acquire)) continue;
+            if (playing_sample->stream->ended.load(std::memory_order_relaxed)) continue;
+            decode_ahead(*playing_sample);
+        }
+        
+        //let go of streams that are done (closing their files here, not on the audio thread):
+        streams.erase(std::remove_if(streams.begin(), streams.end(),
+                                     [](std::shared_ptr<Sound::PlayingSample> const &playing_sample) {
+                                         Sound::StreamBuffer &stream = *playing_sample->stream;
+                                         if (!playing_sample->stopped.load(std::memory_order_acquire)
+                                             && !stream.ended.load(std::memory_order_relaxed)) {
+                                             return false;
+                                         }
+                                         stream.opus.reset();
+                                         return true;
+                                     }), streams.end());
+    }
+}
@@ -2,6 +2,7 @@
 
 #include <glm/glm.hpp>
 
+#include <atomic>
 #include <memory>
 #include <vector>
 #include <string>
@@ -9,6 +10,8 @@
 
 //Game audio system. Simplified from f18-base3.
 //Uses 48kHz sampling rate.
+//Call the functions here from one thread (the game's); changes are queued for the audio thread,
+// so they never wait on it (and it never waits on them).
 
 namespace Sound {
 
@@ -21,10 +24,26 @@ namespace Sound {
         //Directly supply an audio buffer:
         explicit Sample(std::vector<float> const &data);
         
-        //sample data is stored as 48kHz, mono, floating-point:
+        //Stream from an '.opus' file instead of loading it, e.g. Sample(filename, Sample::Stream):
+        //  each time the sample is played, the file is decoded (just ahead of playback) on a background thread,
+        //  so memory use doesn't grow with the length of the file and nothing is decoded up front.
+        //  (good for long sounds, like music; throws if the file can't be opened)
+        enum StreamTag {
+            Stream
+        };
+        
+        Sample(std::string const &filename, StreamTag);
+        
+        //sample data is stored as 48kHz, mono, floating-point: (empty for streamed samples)
         std::vector<float> data;
+        
+        //file to stream from: (empty unless streamed)
+        std::string stream_filename;
     };
 
+//decoded audio on its way from the background decoder to the mixer (defined in Sound.cpp):
+    struct StreamBuffer;
+
 //Ramp<> manages values that should be smoothly interpolated
 //  to a target over a certain amount of time:
     template<typename T>
@@ -50,8 +69,8 @@ namespace Sound {
     };
 
 // 'PlayingSample' objects book-keep samples that are currently playing:
-    struct PlayingSample {
-        //change the panning or volume of a playing sample (and do proper locking);
+    struct PlayingSample : std::enable_shared_from_this< PlayingSample > {
+        //change the panning or volume of a playing sample (queued for the audio thread);
         // value will change over 'ramp' seconds to avoid creating audible artifacts:
         void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
         
@@ -67,14 +86,16 @@ namespace Sound {
         //'stop' will fade sample out over 'ramp' seconds and then remove it from the active samples:
         void stop(float ramp = 1.0f / 60.0f);
         
+        //was playback stopped (either by running out of sample, or by stop())? (set by the audio thread)
+        std::atomic<bool> stopped{false};
+        
         //internals:
-        //NOTE: PlayingSample is used in a separate thread; so setting these values directly
-        // may result in bad results. Instead, use the functions above, which perform locking!
+        //NOTE: everything below belongs to the audio thread once the sample is playing; so setting or even
+        // reading these values from elsewhere is a race. Instead, use the functions above, which queue changes!
         std::vector<float> const &data; //reference to sample data being played
         uint32_t i = 0; //next data value to read
         bool loop = false; //should playback loop after data runs out?
         bool stopping = false; //is playing stopping?
-        bool stopped = false; //was playback stopped (either by running out of sample, or by stop())?
         
         Ramp<float> volume = Ramp<float>(1.0f);
         
@@ -85,6 +106,9 @@ namespace Sound {
         Ramp<glm::vec3> position = Ramp<glm::vec3>(std::numeric_limits<float>::quiet_NaN());
         Ramp<float> half_volume_radius = Ramp<float>(std::numeric_limits<float>::quiet_NaN());
         
+        //streamed samples read from here instead of data: (nullptr if not streamed)
+        std::shared_ptr<StreamBuffer> stream;
+        
         PlayingSample(Sample const &sample_, float volume_, float pan_, bool loop_)
                 : data(sample_.data), loop(loop_), volume(volume_), pan(pan_) {}
         
@@ -99,6 +123,8 @@ namespace Sound {
     void init(); //call Sound::init() from main.cpp before using any member functions
     
     void shutdown(); //call Sound::shutdown() from main.cpp to gracefully(-ish) exit
+    
+    void update(); //call Sound::update() from main.cpp once a frame to free samples that finished playing
 
 //Call 'Sound::play' to play a sample once.
 //  if you hang on to the return value, you can change the panning, volume, or stop playback early.
@@ -136,7 +162,7 @@ namespace Sound {
     struct Listener {
         void set_position_right(glm::vec3 const &new_position, glm::vec3 const &new_right, float ramp = 1.0f / 60.0f);
         
-        //internals:
+        //internals: (belong to the audio thread, like PlayingSample's)
         Ramp<glm::vec3> position = Ramp<glm::vec3>(0.0f); //listener's location
         Ramp<glm::vec3> right = Ramp<glm::vec3>(1.0f, 0.0f, 0.0f); //unit vector pointing to listener's right
     };
@@ -149,13 +175,6 @@ namespace Sound {
 //set global volume:
     void set_volume(float new_volume, float ramp = 1.0f / 60.0f);
     
-    extern Ramp<float> volume;
-
-//the audio callback doesn't run between Sound::lock() and Sound::unlock()
-// the set_*/stop/play/... functions already use these helpers, so you shouldn't need
-// to call them unless your code is modifying values directly:
-    void lock();
-    
-    void unlock();
+    extern Ramp<float> volume; //(belongs to the audio thread; use set_volume)
     
 } //namespace Sound
@@ -0,0 +1,122 @@
+#include "UniformRing.hpp"
+
+#include "gl_errors.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+UniformRing::UniformRing(size_t size_) : size(size_) {
+    GLint offset_alignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &offset_alignment);
+    if (offset_alignment > 0) alignment = size_t(offset_alignment);
+    
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    
+    GL_ERRORS();
+}
+
+UniformRing::~UniformRing() {
+    for (auto &range: in_use) {
+        if (range.sync) glDeleteSync(range.sync);
+    }
+    in_use.clear();
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+void UniformRing::reserve(size_t bytes) {
+    if (head + bytes > size) head = 0; //wrap around
+    
+    //find the newest range that overlaps [head, head + bytes):
+    size_t overlap = in_use.size();
+    for (size_t i = 0; i < in_use.size(); ++i) {
+        if (in_use[i].begin < head + bytes && head < in_use[i].end) overlap = i;
+    }
+    
+    if (bytes > size || (overlap < in_use.size() && in_use[overlap].sync == nullptr)) {
+        //data written since the last fence() would be overwritten, so make a bigger buffer:
+        // (re-specifying the data store orphans the old one, so draws already issued still read the old data)
+        size = std::max(2 * size, bytes);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        for (auto &range: in_use) {
+            if (range.sync) glDeleteSync(range.sync);
+        }
+        in_use.clear();
+        head = 0;
+        return;
+    }
+    
+    if (overlap == in_use.size()) return; //nothing in the way
+    
+    //the GPU finishes work in order, so once the newest overlapping range is done, all older ones are too:
+    GLsync sync = in_use[overlap].sync;
+    while (true) {
+        GLenum result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); //(1 second)
+        if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED || result == GL_WAIT_FAILED) break;
+    }
+    for (size_t i = 0; i <= overlap; ++i) {
+        glDeleteSync(in_use.front().sync);
+        in_use.pop_front();
+    }
+}
+
+GLintptr UniformRing::write(void const *data, size_t bytes) {
+    GLintptr offset = 0;
+    std::memcpy(map(bytes, &offset), data, bytes);
+    unmap();
+    return offset;
+}
+
+void *UniformRing::map(size_t bytes, GLintptr *offset_) {
+    assert(offset_);
+    assert(bytes != 0);
+    assert(mapped_bytes == 0 && "map() called again without unmap()");
+    
+    size_t aligned = (bytes + alignment - 1) / alignment * alignment;
+    reserve(aligned);
+    
+    mapped_offset = GLintptr(head);
+    mapped_bytes = bytes;
+    
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    void *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, mapped_offset, GLsizeiptr(bytes),
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    if (!mapped) {
+        staging.resize(bytes);
+        mapped = staging.data();
+    }
+    
+    in_use.emplace_back(Range{head, head + aligned, nullptr});
+    head += aligned;
+    
+    *offset_ = mapped_offset;
+    return mapped;
+}
+
+void UniformRing::unmap() {
+    assert(mapped_bytes != 0 && "unmap() called without map()");
+    
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    if (staging.empty()) {
+        glUnmapBuffer(GL_UNIFORM_BUFFER);
+    } else {
+        glBufferSubData(GL_UNIFORM_BUFFER, mapped_offset, GLsizeiptr(mapped_bytes), staging.data());
+        staging.clear();
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    
+    mapped_bytes = 0;
+}
+
+void UniformRing::fence() {
+    for (auto range = in_use.rbegin(); range != in_use.rend() && range->sync == nullptr; ++range) {
+        range->sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+}
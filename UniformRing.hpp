@@ -0,0 +1,67 @@
+#pragma once
+
+/*
+ * A UniformRing streams uniform data (e.g., per-object matrices) into one uniform buffer
+ *  that is re-used frame after frame; draws then select their slice with glBindBufferRange.
+ *
+ * Data is written into the next free range of the buffer with an unsynchronized map
+ *  (so the driver never stalls or makes a copy), and fence() drops a sync object after
+ *  the draws that read it; a range is only overwritten once its fence has passed.
+ *
+ * (OpenGL 3.3 doesn't have persistently-mapped buffers; this is the nearest equivalent.)
+ */
+
+#include "GL.hpp"
+
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+struct UniformRing {
+    //make a ring with an initial buffer size (grows if a single write() needs more):
+    explicit UniformRing(size_t size = 1 << 20);
+    
+    ~UniformRing();
+    
+    //the ring owns GL objects, so copying is not allowed:
+    UniformRing(UniformRing const &) = delete;
+    
+    UniformRing &operator=(UniformRing const &) = delete;
+    
+    //copy data into the ring:
+    // returns the offset of the data in 'buffer' (a multiple of GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT)
+    GLintptr write(void const *data, size_t bytes);
+    
+    //..or write data in place: map() returns memory for 'bytes' of data (write-only; don't read it back),
+    // and sets *offset_ to where it will land in 'buffer'; call unmap() once the data is written:
+    // (only one range may be mapped at a time, and 'buffer' must not be used by GL calls until unmap())
+    void *map(size_t bytes, GLintptr *offset_);
+    
+    void unmap();
+    
+    //mark everything written so far as in use by the draws issued so far:
+    void fence();
+    
+    GLuint buffer = 0;
+    size_t size = 0;
+    size_t alignment = 256; //GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+    
+    //-- internals ---
+    
+    size_t head = 0; //next write goes here (if it fits)
+    
+    //ranges that draws might still be reading, oldest first:
+    struct Range {
+        size_t begin, end;
+        GLsync sync; //nullptr if not yet fenced
+    };
+    std::deque<Range> in_use;
+    
+    //the range handed out by map():
+    GLintptr mapped_offset = 0;
+    size_t mapped_bytes = 0;
+    std::vector<char> staging; //stands in for the mapping if glMapBufferRange fails (sent with glBufferSubData)
+    
+    //make room for a range starting at head, waiting for (or, if it isn't fenced yet, growing past) old data:
+    void reserve(size_t bytes);
+};
@@ -2,8 +2,20 @@
 #include "data_path.hpp"
 #include "util.hpp"
 #include "LitColorTextureProgram.hpp"
+#include "gl_errors.hpp"
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
+#include <stdexcept>
+
+WriteGlyphScene::WriteGlyphScene(
+        std::string const &filename,
+        std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable,
+        std::shared_ptr<Font> font_
+) : Scene(filename, on_drawable), font(std::move(font_)) {
+    assert(font);
+}
 
 WriteGlyphScene::WriteGlyphScene(
         std::string const &filename,
@@ -11,51 +23,188 @@ WriteGlyphScene::WriteGlyphScene(
         std::string const &font_ttf,
         std::string const &font_pnct,
         std::string const &font_txtr
-) : Scene(filename, on_drawable),
-    font_meshes(font_pnct),
-    font_program(font_meshes.make_vao_for_program(lit_color_texture_program->program)),
-    textures(get_font_textures(font_txtr)) {
-    // wouldn't it be nice if there was a standardized autoformatter and i didn't ever have to think about formatting ever again? we tend to say the same thing about package managers
-    if (FT_Init_FreeType(&library)) {
-        assert(false && "Problem initializing FreeType");
-    }
-    if (FT_New_Face(library, font_ttf.c_str(), 0, &face)) {
-        assert(false && "Problem initializing font");
+) : WriteGlyphScene(filename, on_drawable, std::make_shared<Font>(font_ttf, font_pnct, font_txtr)) {
+}
+
+WriteGlyphScene::WriteGlyphScene(
+        std::string const &filename,
+        std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable,
+        std::string const &font_ttf
+) : WriteGlyphScene(filename, on_drawable, std::make_shared<Font>(font_ttf)) {
+}
+
+WriteGlyphScene::WriteGlyphScene(WriteGlyphScene const &other) :
+        Scene(other),
+        font(other.font),
+        fallback_fonts(other.fallback_fonts),
+        use_instancing(other.use_instancing) {
+}
+
+void WriteGlyphScene::add_fallback_font(std::shared_ptr<Font> fallback) {
+    assert(fallback);
+    if (fallback_fonts.size() >= 255) {
+        throw std::runtime_error("WriteGlyphScene can't have more than 255 fallback fonts");
     }
-    if (FT_Set_Char_Size(face, PIXEL_COUNT * 64, 0, 0, 0)) {
-        assert(false && "Problem setting character size");
+    fallback_fonts.emplace_back(std::move(fallback));
+}
+
+uint8_t WriteGlyphScene::chain_font_for(uint32_t codepoint) const {
+    if (font->covers(codepoint)) return 0;
+    for (size_t i = 0; i < fallback_fonts.size(); i++) {
+        if (fallback_fonts[i]->covers(codepoint)) return (uint8_t) (i + 1);
     }
+    return 0;
 }
 
 WriteGlyphScene::~WriteGlyphScene() {
-    FT_Done_Face(face);
-    FT_Done_FreeType(library);
+    for (auto &entry: glyph_instances) {
+        // the font outlives this scene if anything else shares it, so let its cache evict these glyphs
+        GlyphCache *glyph_cache = entry.second.font->glyph_cache.get();
+        if (glyph_cache) {
+            for (uint32_t glyph_index: entry.second.glyphs) {
+                glyph_cache->release(glyph_index);
+            }
+        }
+        glDeleteVertexArrays(1, &entry.second.vao);
+        glDeleteBuffers(1, &entry.second.buffer);
+    }
 }
 
 /*
  * Draws a glyph at a transform. (The transform need not be in the scene's transforms list.)
  */
-void WriteGlyphScene::write_glyph_at(Transform *transform, std::string const &glyph_name) {
-    Mesh mesh = font_meshes.lookup(glyph_name);
-    assert(textures.count(glyph_name));
-    GLuint texture = textures[glyph_name];
-
-//    std::cerr << "Writing glyph " << glyph_name << " at " << transform->position.x << ", " << transform->position.y << "\n";
+void WriteGlyphScene::write_glyph_at(Transform *transform, uint32_t glyph_index, uint8_t font_index) {
+    Font &glyph_font = chain_font(font_index);
+    assert(glyph_index < glyph_font.glyphs.size());
+    Font::Glyph const &glyph = glyph_font.glyphs[glyph_index];
+    GLuint texture = glyph.texture;
+    GlyphCache *glyph_cache = glyph_font.glyph_cache.get();
+    if (glyph_cache) {
+        // the glyph might not be in the atlas yet, but its glyph table entry gets filled in when it is
+        glyph_cache->acquire(glyph_index);
+        texture = glyph_cache->atlas;
+    } else if (texture == 0) {
+        // glyphs render-glyphs couldn't name have nothing to draw
+        return;
+    }
+    
+    if (use_instancing || glyph_cache) {
+        auto inserted = glyph_instances.emplace(texture, GlyphInstances());
+        GlyphInstances &group = inserted.first->second;
+        if (inserted.second) {
+            // first glyph with this texture, so make the group's buffer and drawable
+            group.font = &glyph_font;
+            glGenBuffers(1, &group.buffer);
+            group.vao = glyph_font.glyph_instance_program_->make_vao(group.buffer);
+            
+            drawables.emplace_back(&glyph_instances_root);
+            Drawable &drawable = drawables.back();
+            drawable.pipeline = glyph_font.glyph_instance_pipeline;
+            drawable.pipeline.vao = group.vao;
+            drawable.pipeline.textures[0].texture = texture;
+            drawable.pipeline.textures[1].texture = glyph_font.glyph_table_texture;
+            drawable.pipeline.layer = 1;
+            group.drawable = &drawable;
+        }
+        WrittenGlyph &written = written_glyphs[transform];
+        written.texture = texture;
+        written.index = (uint32_t) group.transforms.size();
+        group.transforms.push_back(transform);
+        group.glyphs.push_back(glyph_index);
+        return;
+    }
     
     drawables.emplace_back(transform);
     Drawable &drawable = drawables.back();
+    written_glyphs[transform].drawable = std::prev(drawables.end());
     
-    drawable.pipeline = lit_color_texture_program_pipeline;
-    drawable.pipeline.vao = font_program;
+    drawable.pipeline = glyph_font.glyph_pipeline;
+    drawable.pipeline.vao = glyph_font.meshes_for_glyph_program;
     drawable.pipeline.textures[0].texture = texture;
-    drawable.pipeline.type = mesh.type;
-    drawable.pipeline.start = mesh.start;
-    drawable.pipeline.count = mesh.count;
+    drawable.pipeline.type = glyph.mesh.type;
+    drawable.pipeline.start = glyph.mesh.start;
+    drawable.pipeline.count = glyph.mesh.count;
+    drawable.min = glyph.mesh.min;
+    drawable.max = glyph.mesh.max;
+    // glyphs are blended, so keep them after the opaque scene geometry when the scene sorts its drawables
+    drawable.pipeline.layer = 1;
+}
+
+void WriteGlyphScene::write_glyph_at(Transform *transform, std::string const &glyph_name) {
+    write_glyph_at(transform, font->glyph_index(glyph_name));
 }
 
 /*
- * Erases a glyph based on its transform. (Technically can erase any drawable, oopsie)
+ * Erases a glyph based on its transform. (Technically can erase any drawable, oopsie, though that means a search.)
  */
 void WriteGlyphScene::erase_glyph_at(Scene::Transform *transform) {
-    drawables.remove_if([transform](Drawable &drawable) { return drawable.transform == transform; });
+    auto found = written_glyphs.find(transform);
+    if (found == written_glyphs.end()) {
+        drawables.remove_if([transform](Drawable &drawable) { return drawable.transform == transform; });
+        return;
+    }
+    
+    WrittenGlyph const &written = found->second;
+    if (written.texture != 0) {
+        // swap with the last instance in the group; order within a group doesn't matter
+        GlyphInstances &group = glyph_instances.at(written.texture);
+        uint32_t i = written.index;
+        assert(i < group.transforms.size() && group.transforms[i] == transform);
+        if (group.font->glyph_cache) group.font->glyph_cache->release(group.glyphs[i]);
+        Transform const *moved = group.transforms.back();
+        group.transforms[i] = moved;
+        group.transforms.pop_back();
+        group.glyphs[i] = group.glyphs.back();
+        group.glyphs.pop_back();
+        if (moved != transform) written_glyphs.at(moved).index = i;
+    } else {
+        drawables.erase(written.drawable);
+    }
+    written_glyphs.erase(found);
+}
+
+void WriteGlyphScene::update_glyph_cache() {
+    font->update_glyph_cache();
+    for (auto const &fallback: fallback_fonts) {
+        fallback->update_glyph_cache();
+    }
+}
+
+void WriteGlyphScene::update_glyph_instances() {
+    std::vector<GlyphInstanceProgram::Instance> data;
+    Transform::Frozen frozen;
+    for (auto &entry: glyph_instances) {
+        GlyphInstances &group = entry.second;
+        data.clear();
+        data.reserve(group.transforms.size());
+        for (size_t i = 0; i < group.transforms.size(); i++) {
+            GlyphInstanceProgram::Instance instance{};
+            instance.to_object = group.transforms[i]->make_local_to_world();
+            instance.glyph = group.glyphs[i];
+            // same color render-glyphs gives the glyph vertices
+            instance.color = glm::u8vec4(0x00, 0x00, 0x00, 0xff);
+            data.push_back(instance);
+        }
+        
+        // text mostly sits still, so skip the upload when nothing moved
+        if (data.size() != group.uploaded.size()
+            || (!data.empty() && std::memcmp(data.data(), group.uploaded.data(), data.size() * sizeof(data[0])) != 0)) {
+            glBindBuffer(GL_ARRAY_BUFFER, group.buffer);
+            glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(data[0]), data.data(), GL_STREAM_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            group.uploaded.swap(data);
+        }
+        group.drawable->pipeline.instances = (GLuint) group.uploaded.size();
+    }
+    
+    GL_ERRORS();
+}
+
+void WriteGlyphScene::update() {
+    update_glyph_cache();
+    update_glyph_instances();
+}
+
+bool WriteGlyphScene::copy_drawable(Drawable const &drawable) const {
+    return drawable.transform != &glyph_instances_root && written_glyphs.count(drawable.transform) == 0;
 }
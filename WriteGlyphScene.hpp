@@ -1,32 +1,97 @@
 #pragma once
 
-#include <ft2build.h>
-#include FT_FREETYPE_H
-
-#include <hb.h>
-#include <hb-ft.h>
-
 #include "Scene.hpp"
-#include "get_font_textures.hpp"
-#include "Mesh.hpp"
+#include "Font.hpp"
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
 
 struct WriteGlyphScene : Scene {
-    FT_Library library{};
-    FT_Face face{};
+    // The font is shared with copies of the scene (and anything else that was given it), never copied.
+    std::shared_ptr<Font> font;
+    
+    // Fonts to try, in order, for codepoints font doesn't have. Glyphs say which font they're from by index:
+    // 0 is font, and i is fallback_fonts[i - 1] (see chain_font). Add fonts with add_fallback_font.
+    std::vector<std::shared_ptr<Font>> fallback_fonts;
+    
+    // Adds a font to the end of the chain. (Fonts can't be taken out again, since written glyphs refer to them.)
+    virtual void add_fallback_font(std::shared_ptr<Font> fallback);
+    
+    Font &chain_font(uint8_t index) const { return index == 0 ? *font : *fallback_fonts[index - 1]; }
     
-    MeshBuffer font_meshes;
-    GLuint font_program;
-    std::map<std::string, GLuint> textures;
+    // The first font in the chain that has a codepoint (or font, if none do):
+    uint8_t chain_font_for(uint32_t codepoint) const;
+    
+    // When true, glyphs are drawn with glDrawArraysInstanced (one draw per atlas page)
+    // instead of as one Drawable per glyph. Only affects glyphs written after it is changed.
+    // (Glyphs from a glyph cache are always instanced, since they may not be in the atlas yet.)
+    bool use_instancing = true;
     
+    WriteGlyphScene(std::string const &filename,
+                    std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable,
+                    std::shared_ptr<Font> font);
+    
+    // Load a font just for this scene (and its copies) from render-glyphs' files:
     WriteGlyphScene(std::string const &filename,
                     std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable,
                     std::string const &font_ttf,
                     std::string const &font_pnct,
                     std::string const &font_txtr);
     
+    // ...or from just the .ttf, rasterizing glyphs as they're first written (see GlyphCache):
+    WriteGlyphScene(std::string const &filename,
+                    std::function<void(Scene &, Transform *, std::string const &)> const &on_drawable,
+                    std::string const &font_ttf);
+    
+    // Copies the scene (sharing the fonts), but none of the glyphs written into it: they're drawn at transforms that
+    // aren't in the scene's transforms list, so copy_drawable leaves their drawables out.
+    WriteGlyphScene(WriteGlyphScene const &other);
+    
+    // (assigning would take over other's glyph buffers, which this scene would then delete; copy-construct instead)
+    WriteGlyphScene &operator=(WriteGlyphScene const &) = delete;
+    
     ~WriteGlyphScene();
     
+    // (glyph_index is a glyph index in chain_font(font_index))
+    void write_glyph_at(Transform *transform, uint32_t glyph_index, uint8_t font_index = 0);
+    
+    // Looks up the glyph (in font) by name first, so prefer the glyph index version when you have one.
     void write_glyph_at(Transform *transform, std::string const &glyph_name);
     
     void erase_glyph_at(Transform *transform);
+    
+    // Picks up glyphs the fonts' glyph caches have finished (or evicted) since the last call. Called by update().
+    virtual void update_glyph_cache();
+    
+    // Updates the glyph cache and uploads instanced glyph transforms. Call once a frame, after moving things and
+    // before draw() (which doesn't do this itself, since it's const).
+    void update();
+    
+    // Leaves out the drawables of written glyphs (see the copy constructor).
+    bool copy_drawable(Drawable const &drawable) const override;
+    
+    // All instanced glyphs using the same texture (so also the same font) share one buffer and one Drawable:
+    struct GlyphInstances {
+        Font *font = nullptr;
+        GLuint buffer = 0;
+        GLuint vao = 0;
+        std::vector<Transform const *> transforms;
+        std::vector<uint32_t> glyphs;
+        std::vector<GlyphInstanceProgram::Instance> uploaded; // contents of buffer
+        Drawable *drawable = nullptr;
+    };
+    std::map<GLuint, GlyphInstances> glyph_instances;
+    // Where each glyph written by write_glyph_at ended up, so erase_glyph_at doesn't have to search:
+    struct WrittenGlyph {
+        GLuint texture = 0; // instanced: key in glyph_instances (0 for glyphs with their own drawable)
+        uint32_t index = 0; // instanced: position in the group's arrays
+        std::list<Drawable>::iterator drawable; // not instanced: the glyph's drawable
+    };
+    std::unordered_map<Transform const *, WrittenGlyph> written_glyphs;
+    // instance data is already in world space, so group drawables sit at the origin
+    Transform glyph_instances_root;
+    
+    // Rebuild each group's instance data from its transforms, uploading only what changed.
+    void update_glyph_instances();
 };
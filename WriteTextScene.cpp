@@ -1,69 +1,795 @@
 #include "WriteTextScene.hpp"
+#include "LitColorTextureProgram.hpp"
+#include "gl_errors.hpp"
 #include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
 #include <iostream>
+#include <map>
+#include <stdexcept>
+#include <tuple>
 
 WriteTextScene::WriteTextScene(const WriteGlyphScene &scene) :
-        WriteGlyphScene(scene) {
-    font = hb_ft_font_create_referenced(face);
+        WriteGlyphScene(scene),
+        text_vertices(sizeof(TextVertex)) {
+    text_vao_for(font->glyph_program);
 }
 
 WriteTextScene::~WriteTextScene() {
-    hb_font_destroy(font);
+    // let the fonts' (shared) glyph caches evict whatever baked lines were holding on to
+    // (glyphs of lines that aren't baked are released along with the glyph instances)
+    for (LineSlot &slot: line_slots) {
+        if (!slot.live || !slot.line.baked) continue;
+        for (TextLine::Glyph const &glyph: slot.line.glyphs) {
+            GlyphCache *glyph_cache = chain_font(glyph.font).glyph_cache.get();
+            if (glyph_cache) glyph_cache->release(glyph.glyph);
+        }
+    }
+    for (auto const &entry: text_vaos) {
+        glDeleteVertexArrays(1, &entry.second);
+    }
+    for (hb_buffer_t *buffer: buffer_pool) {
+        hb_buffer_destroy(buffer);
+    }
 }
 
-Scene::Transform *WriteTextScene::write_line(const std::string &s) {
-    // based on https://github.com/harfbuzz/harfbuzz-tutorial/blob/master/hello-harfbuzz-freetype.c
-    hb_buffer_t *buffer;
-    buffer = hb_buffer_create();
-    hb_buffer_add_utf8(buffer, s.c_str(), -1, 0, -1);
-    hb_buffer_guess_segment_properties(buffer);
+GLuint WriteTextScene::text_vao_for(LitColorTextureProgram const *program) {
+    auto inserted = text_vaos.emplace(program, 0);
+    GLuint &vao = inserted.first->second;
+    if (!inserted.second) return vao;
     
-    hb_shape(font, buffer, nullptr, 0);
+    // the arena's buffer keeps its name when it grows, so this only needs setting up once
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, text_vertices.buffer);
+    auto bind_attribute = [](GLuint location, GLint size, GLenum type, GLboolean normalized, size_t offset) {
+        glVertexAttribPointer(location, size, type, normalized, sizeof(TextVertex), (GLbyte *) nullptr + offset);
+        glEnableVertexAttribArray(location);
+    };
+    bind_attribute(program->Position_vec4, 3, GL_FLOAT, GL_FALSE, offsetof(TextVertex, Position));
+    bind_attribute(program->Normal_vec3, 3, GL_FLOAT, GL_FALSE, offsetof(TextVertex, Normal));
+    bind_attribute(program->Color_vec4, 4, GL_UNSIGNED_BYTE, GL_TRUE, offsetof(TextVertex, Color));
+    bind_attribute(program->TexCoord_vec2, 2, GL_FLOAT, GL_FALSE, offsetof(TextVertex, TexCoord));
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
     
+    GL_ERRORS();
+    return vao;
+}
+
+void WriteTextScene::add_fallback_font(std::shared_ptr<Font> fallback) {
+    WriteGlyphScene::add_fallback_font(std::move(fallback));
+    shape_lru.clear();
+    shape_cache.clear();
+}
+
+hb_buffer_t *WriteTextScene::acquire_buffer() {
+    hb_buffer_t *buffer;
+    if (buffer_pool.empty()) {
+        buffer = hb_buffer_create();
+    } else {
+        buffer = buffer_pool.back();
+        buffer_pool.pop_back();
+    }
+#if HB_VERSION_ATLEAST(3, 3, 0)
+    // newer HarfBuzz can also say where shaping two pieces separately and sticking them together goes wrong
+    hb_buffer_set_flags(buffer, HB_BUFFER_FLAG_PRODUCE_UNSAFE_TO_CONCAT);
+#endif
+    return buffer;
+}
+
+void WriteTextScene::release_buffer(hb_buffer_t *buffer) {
+    hb_buffer_clear_contents(buffer);
+    buffer_pool.push_back(buffer);
+}
+
+// Appends what HarfBuzz made of a buffer (shaped with the chain's font_index) to glyphs_:
+static void read_glyphs(hb_buffer_t *buffer, uint8_t font_index, std::vector<WriteTextScene::ShapedGlyph> *glyphs_) {
+    auto &glyphs = *glyphs_;
     unsigned int len = hb_buffer_get_length(buffer);
     hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buffer, nullptr);
     hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buffer, nullptr);
     
-    lines.emplace_back();
-    TextLine &line = lines.back();
-    line.transforms.resize(len);
-    
-    {
-        float x = 0, y = 0;
-        auto transform = line.transforms.begin();
-        for (unsigned int i = 0; i < len; i++, transform++) {
-            hb_codepoint_t gid = info[i].codepoint;
-            char buf[64];
-            if (FT_Get_Glyph_Name(face, gid, buf, 64)) {
-                std::cerr << "Warning: problem getting glyph name for " << gid << "\n";
+    glyphs.reserve(glyphs.size() + len);
+    for (unsigned int i = 0; i < len; i++) {
+        hb_glyph_flags_t flags = hb_glyph_info_get_glyph_flags(&info[i]);
+        WriteTextScene::ShapedGlyph glyph{};
+        glyph.glyph = info[i].codepoint; // after shaping, the codepoint is the glyph index
+        glyph.font = font_index;
+        glyph.cluster = info[i].cluster;
+#if HB_VERSION_ATLEAST(3, 3, 0)
+        glyph.unsafe_to_break = (flags & (HB_GLYPH_FLAG_UNSAFE_TO_BREAK | HB_GLYPH_FLAG_UNSAFE_TO_CONCAT)) != 0;
+#else
+        glyph.unsafe_to_break = (flags & HB_GLYPH_FLAG_UNSAFE_TO_BREAK) != 0;
+#endif
+        glyph.x_advance = pos[i].x_advance;
+        glyph.y_advance = pos[i].y_advance;
+        glyph.x_offset = pos[i].x_offset;
+        glyph.y_offset = pos[i].y_offset;
+        glyphs.push_back(glyph);
+    }
+}
+
+hb_segment_properties_t WriteTextScene::guess_properties(std::string const &s, uint32_t start) {
+    hb_buffer_t *buffer = acquire_buffer();
+    hb_buffer_add_utf8(buffer, s.c_str(), (int) s.size(), start, -1);
+    hb_buffer_guess_segment_properties(buffer);
+    hb_segment_properties_t properties;
+    hb_buffer_get_segment_properties(buffer, &properties);
+    release_buffer(buffer);
+    return properties;
+}
+
+// Decodes the UTF-8 codepoint at s[at], and says how many bytes it took (invalid bytes are U+FFFD, one byte each):
+static uint32_t decode_utf8(std::string const &s, size_t at, uint32_t *length_) {
+    auto byte = [&](size_t i) { return (uint8_t) s[i]; };
+    uint8_t lead = byte(at);
+    uint32_t length = lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xe ? 3 : (lead >> 3) == 0x1e ? 4 : 0;
+    uint32_t codepoint = length == 1 ? lead : length == 2 ? (lead & 0x1f) : length == 3 ? (lead & 0x0f) : (lead & 0x07);
+    if (length == 0 || at + length > s.size()) {
+        *length_ = 1;
+        return 0xfffd;
+    }
+    for (uint32_t i = 1; i < length; i++) {
+        if ((byte(at + i) & 0xc0) != 0x80) {
+            *length_ = 1;
+            return 0xfffd;
+        }
+        codepoint = (codepoint << 6) | (byte(at + i) & 0x3f);
+    }
+    *length_ = length;
+    return codepoint;
+}
+
+void WriteTextScene::shape_runs(std::string const &s, uint32_t start, hb_segment_properties_t const &properties,
+                                std::vector<ShapedGlyph> *glyphs_) {
+    auto &glyphs = *glyphs_;
+    size_t first = glyphs.size();
+    hb_unicode_funcs_t *unicode = hb_unicode_funcs_get_default();
+    
+    // marks and spaces shouldn't pull a run apart (e.g. an accent on a letter from a fallback font):
+    auto sticks = [&](uint32_t codepoint) {
+        switch (hb_unicode_general_category(unicode, codepoint)) {
+            case HB_UNICODE_GENERAL_CATEGORY_NON_SPACING_MARK:
+            case HB_UNICODE_GENERAL_CATEGORY_SPACING_MARK:
+            case HB_UNICODE_GENERAL_CATEGORY_ENCLOSING_MARK:
+            case HB_UNICODE_GENERAL_CATEGORY_SPACE_SEPARATOR:
+            case HB_UNICODE_GENERAL_CATEGORY_FORMAT: // e.g. zero width joiners
+                return true;
+            default:
+                return false;
+        }
+    };
+    
+    uint32_t begin = start;
+    do {
+        // find the end of the run (with no fallback fonts, the whole string is one run):
+        uint8_t run_font = 0;
+        uint32_t end = (uint32_t) s.size();
+        if (!fallback_fonts.empty()) {
+            end = begin;
+            while (end < s.size()) {
+                uint32_t length;
+                uint32_t codepoint = decode_utf8(s, end, &length);
+                uint8_t f = chain_font_for(codepoint);
+                if (end == begin) {
+                    run_font = f;
+                } else if (f != run_font && !(chain_font(run_font).covers(codepoint) && sticks(codepoint))) {
+                    break;
+                }
+                end += length;
+            }
+        }
+        
+        hb_buffer_t *buffer = acquire_buffer();
+        // based on https://github.com/harfbuzz/harfbuzz-tutorial/blob/master/hello-harfbuzz-freetype.c
+        // (HarfBuzz still sees the text outside the run as context, and clusters stay offsets into all of s)
+        hb_buffer_add_utf8(buffer, s.c_str(), (int) s.size(), begin, (int) (end - begin));
+        hb_buffer_set_segment_properties(buffer, &properties);
+        chain_font(run_font).shape(buffer);
+        size_t run_first = glyphs.size();
+        read_glyphs(buffer, run_font, &glyphs);
+        release_buffer(buffer);
+        
+        // right-to-left glyphs come out in visual order, so later runs go before earlier ones
+        if (HB_DIRECTION_IS_BACKWARD(properties.direction)) {
+            std::rotate(glyphs.begin() + first, glyphs.begin() + run_first, glyphs.end());
+        }
+        begin = end;
+    } while (begin < s.size());
+}
+
+WriteTextScene::ShapedRun const &WriteTextScene::shape(std::string const &s) {
+    ShapeKey key{font->hb_font, s};
+    
+    auto found = shape_cache.find(key);
+    if (found != shape_cache.end()) {
+        shape_stats.hits++;
+        shape_lru.splice(shape_lru.begin(), shape_lru, found->second);
+        return found->second->second;
+    }
+    
+    // Typing adds to the end of a string, so look for the longest cached string this one starts with.
+    // Only left-to-right runs, since that's when glyph order follows the text.
+    ShapedRun const *prefix = nullptr;
+    size_t prefix_length = 0;
+    for (auto const &entry: shape_lru) {
+        std::string const &text = entry.first.text;
+        if (entry.first.font == font->hb_font && text.size() > prefix_length && text.size() < s.size()
+            && entry.second.properties.direction == HB_DIRECTION_LTR
+            && s.compare(0, text.size(), text) == 0) {
+            prefix = &entry.second;
+            prefix_length = text.size();
+        }
+    }
+    
+    // Keep the prefix's glyphs up to the last place HarfBuzz says it's safe to break the text, and never the last
+    // cluster, since the end of the prefix was shaped without knowing what comes after it (e.g., ligatures).
+    size_t keep = 0;
+    uint32_t start = 0;
+    if (prefix && !prefix->glyphs.empty()) {
+        uint32_t last_cluster = prefix->glyphs.back().cluster;
+        for (size_t i = prefix->glyphs.size() - 1; i > 0; i--) {
+            ShapedGlyph const &glyph = prefix->glyphs[i];
+            bool starts_cluster = prefix->glyphs[i - 1].cluster != glyph.cluster;
+            if (glyph.cluster < last_cluster && starts_cluster && !glyph.unsafe_to_break) {
+                keep = i;
+                start = glyph.cluster;
+                break;
+            }
+        }
+    }
+    
+    hb_segment_properties_t properties = guess_properties(s, start);
+    if (keep != 0) {
+        if (properties.script == prefix->properties.script || properties.script == HB_SCRIPT_INVALID) {
+            // (the end may be all spaces or punctuation, which don't say what script they are)
+            properties = prefix->properties;
+        } else {
+            // the end changes how the whole string should be shaped
+            keep = 0;
+            start = 0;
+            properties = guess_properties(s, 0);
+        }
+    }
+    
+    ShapedRun run;
+    run.properties = properties;
+    if (keep != 0) {
+        run.glyphs.insert(run.glyphs.end(), prefix->glyphs.begin(), prefix->glyphs.begin() + keep);
+        shape_stats.prefix_hits++;
+    } else {
+        shape_stats.misses++;
+    }
+    shape_runs(s, start, properties, &run.glyphs);
+    
+    shape_lru.emplace_front(key, std::move(run));
+    shape_cache.emplace(std::move(key), shape_lru.begin());
+    while (shape_lru.size() > std::max(shape_cache_capacity, size_t(1))) {
+        shape_cache.erase(shape_lru.back().first);
+        shape_lru.pop_back();
+    }
+    
+    return shape_lru.front().second;
+}
+
+void WriteTextScene::add_glyphs(TextLine *line, std::vector<ShapedGlyph> const &shaped) {
+    glm::vec2 pen(0.0f);
+    if (!line->glyphs.empty()) pen = line->glyphs.back().pen + line->glyphs.back().advance;
+    
+    line->glyphs.reserve(line->glyphs.size() + shaped.size());
+    for (ShapedGlyph const &s: shaped) {
+        TextLine::Glyph glyph;
+        glyph.glyph = s.glyph;
+        glyph.font = s.font;
+        glyph.cluster = s.cluster;
+        glyph.unsafe_to_break = s.unsafe_to_break;
+        glyph.pen = pen;
+        glyph.offset = glm::vec2(PIXEL_SCALE * (float) s.x_offset / 64.0f, PIXEL_SCALE * (float) s.y_offset / 64.0f);
+        glyph.advance = glm::vec2(PIXEL_SCALE * (float) s.x_advance / 64.0f, PIXEL_SCALE * (float) s.y_advance / 64.0f);
+        pen += glyph.advance;
+        line->glyphs.push_back(glyph);
+    }
+}
+
+void WriteTextScene::draw_glyphs(TextLine *line, size_t first) {
+    if (!line->baked) {
+        assert(line->transforms.size() == first);
+        for (size_t i = first; i < line->glyphs.size(); i++) {
+            TextLine::Glyph const &glyph = line->glyphs[i];
+            line->transforms.emplace_back();
+            Transform &transform = line->transforms.back();
+            transform.parent = &line->base;
+            transform.position.x = glyph.pen.x + glyph.offset.x;
+            transform.position.y = glyph.pen.y + glyph.offset.y;
+            write_glyph_at(&transform, glyph.glyph, glyph.font);
+        }
+        return;
+    }
+    
+    if (first == 0) line->waiting = false;
+    
+    // new quads for each batch (by batch index), in glyph order:
+    std::vector<std::vector<TextVertex>> added;
+    for (size_t i = first; i < line->glyphs.size(); i++) {
+        TextLine::Glyph &glyph = line->glyphs[i];
+        glyph.batch = -1U;
+        Font &glyph_font = chain_font(glyph.font);
+        if (glyph_font.glyph_cache) glyph_font.glyph_cache->acquire(glyph.glyph);
+        
+        assert(glyph.glyph < glyph_font.glyphs.size());
+        Font::Glyph const &font_glyph = glyph_font.glyphs[glyph.glyph];
+        if (font_glyph.texture == 0) {
+            // (not rasterized yet, if there's a glyph cache)
+            if (glyph_font.glyph_cache) line->waiting = true;
+            continue;
+        }
+        if (font_glyph.rect.x >= font_glyph.rect.z) continue; // nothing to draw, e.g. a space
+        
+        // the batch for the glyph's atlas page (lines only use a page or two, so a search is fine; each font has its
+        // own pages, so a batch is always one font's):
+        uint32_t b = 0;
+        while (b < line->batches.size() && line->batches[b].texture != font_glyph.texture) b++;
+        if (b == line->batches.size()) {
+            TextLine::Batch batch;
+            batch.texture = font_glyph.texture;
+            drawables.emplace_back(&line->base);
+            Drawable &drawable = drawables.back();
+            batch.drawable = std::prev(drawables.end());
+            drawable.pipeline = glyph_font.glyph_pipeline;
+            drawable.pipeline.vao = text_vao_for(glyph_font.glyph_program);
+            drawable.pipeline.textures[0].texture = batch.texture;
+            drawable.pipeline.type = GL_TRIANGLES;
+            // same as glyphs: blended, so after the opaque scene geometry
+            drawable.pipeline.layer = 1;
+            line->batches.push_back(batch);
+        }
+        if (added.size() <= b) added.resize(b + 1);
+        std::vector<TextVertex> &vertices = added[b];
+        glyph.batch = b;
+        glyph.vertex = (uint32_t) (line->batches[b].count + vertices.size());
+        
+        // same corners as render-glyphs: TL, TR, BR, TL, BR, BL
+        glm::vec2 at = glyph.pen + glyph.offset;
+        float left = at.x + font_glyph.rect.x, bottom = at.y + font_glyph.rect.y;
+        float right = at.x + font_glyph.rect.z, top = at.y + font_glyph.rect.w;
+        glm::vec4 const &uv = font_glyph.tex_rect;
+        auto vertex = [&](float vx, float vy, float u, float v) {
+            vertices.push_back(TextVertex{
+                    glm::vec3(vx, vy, 0.0f),
+                    glm::vec3(0.0f, 0.0f, 1.0f),
+                    glm::u8vec4(0x00, 0x00, 0x00, 0xff),
+                    glm::vec2(u, v)
+            });
+        };
+        vertex(left, top, uv.x, uv.y);
+        vertex(right, top, uv.z, uv.y);
+        vertex(right, bottom, uv.z, uv.w);
+        vertex(left, top, uv.x, uv.y);
+        vertex(right, bottom, uv.z, uv.w);
+        vertex(left, bottom, uv.x, uv.w);
+    }
+    
+    for (uint32_t b = 0; b < added.size(); b++) {
+        std::vector<TextVertex> const &vertices = added[b];
+        if (vertices.empty()) continue;
+        TextLine::Batch &batch = line->batches[b];
+        size_t count = batch.count + vertices.size();
+        if (count > batch.capacity) {
+            // a newly written line gets exactly its size; lines that are being typed into get room to grow
+            size_t capacity = std::max(count, 2 * batch.capacity);
+            batch.start = text_vertices.reallocate(batch.start, batch.capacity, capacity, batch.count);
+            batch.capacity = capacity;
+        }
+        text_vertices.write(batch.start + batch.count, vertices.data(), vertices.size());
+        batch.count = count;
+        
+        Drawable &drawable = *batch.drawable;
+        drawable.pipeline.start = (GLuint) batch.start;
+        drawable.pipeline.count = (GLuint) batch.count;
+        for (TextVertex const &vertex: vertices) {
+            drawable.min = glm::min(drawable.min, vertex.Position);
+            drawable.max = glm::max(drawable.max, vertex.Position);
+        }
+    }
+}
+
+void WriteTextScene::undraw_glyphs(TextLine *line, size_t first) {
+    if (!line->baked) {
+        // transforms are in glyph order, so the ones to go are at the end
+        while (line->transforms.size() > first) {
+            erase_glyph_at(&line->transforms.back());
+            line->transforms.pop_back();
+        }
+        return;
+    }
+    
+    // quads are in glyph order within each batch too, so each batch just gets shorter
+    for (size_t i = first; i < line->glyphs.size(); i++) {
+        TextLine::Glyph const &glyph = line->glyphs[i];
+        GlyphCache *glyph_cache = chain_font(glyph.font).glyph_cache.get();
+        if (glyph_cache) glyph_cache->release(glyph.glyph);
+        if (glyph.batch != -1U) {
+            TextLine::Batch &batch = line->batches[glyph.batch];
+            batch.count = std::min(batch.count, (size_t) glyph.vertex);
+        }
+    }
+    for (TextLine::Batch &batch: line->batches) {
+        batch.drawable->pipeline.count = (GLuint) batch.count;
+        // (bounds are left as they are; they're only used for culling, so a little too big is fine)
+    }
+    // empty batches at the end go away entirely (only at the end, so glyphs' batch indices stay good)
+    while (!line->batches.empty() && line->batches.back().count == 0) {
+        TextLine::Batch const &batch = line->batches.back();
+        text_vertices.free(batch.start, batch.capacity);
+        drawables.erase(batch.drawable);
+        line->batches.pop_back();
+    }
+}
+
+void WriteTextScene::update_glyph_cache() {
+    WriteGlyphScene::update_glyph_cache();
+    // (another scene sharing a font may have been the one to sync it, so keep track separately; serials only go up,
+    // so the total changes whenever any of them does)
+    uint32_t serial = font->glyphs_serial;
+    for (auto const &fallback: fallback_fonts) {
+        serial += fallback->glyphs_serial;
+    }
+    if (serial == glyphs_serial) return;
+    glyphs_serial = serial;
+    
+    for (LineSlot &slot: line_slots) {
+        if (!slot.live || !slot.line.waiting) continue;
+        undraw_glyphs(&slot.line, 0);
+        draw_glyphs(&slot.line, 0);
+    }
+}
+
+bool WriteTextScene::copy_drawable(Drawable const &drawable) const {
+    if (!WriteGlyphScene::copy_drawable(drawable)) return false;
+    // baked lines are exactly the drawables that read text_vertices
+    for (auto const &entry: text_vaos) {
+        if (drawable.pipeline.vao == entry.second) return false;
+    }
+    return true;
+}
+
+bool WriteTextScene::contains(LineHandle handle) const {
+    return handle.slot < line_slots.size()
+           && line_slots[handle.slot].live
+           && line_slots[handle.slot].generation == handle.generation;
+}
+
+TextLine &WriteTextScene::line(LineHandle handle) {
+    if (!contains(handle)) {
+        throw std::runtime_error("WriteTextScene line handle is not valid (was the line erased?)");
+    }
+    return line_slots[handle.slot].line;
+}
+
+WriteTextScene::LineHandle WriteTextScene::write_line(const std::string &s) {
+    ShapedRun const &run = shape(s);
+    return write_shaped_line(s, run.properties, run.glyphs);
+}
+
+WriteTextScene::LineHandle WriteTextScene::write_shaped_line(std::string const &s,
+                                                             hb_segment_properties_t const &properties,
+                                                             std::vector<ShapedGlyph> const &glyphs) {
+    // find a slot for the line:
+    LineHandle handle;
+    if (free_line_slot != -1U) {
+        handle.slot = free_line_slot;
+        free_line_slot = line_slots[handle.slot].next_free;
+    } else {
+        handle.slot = (uint32_t) line_slots.size();
+        line_slots.emplace_back();
+    }
+    LineSlot &slot = line_slots[handle.slot];
+    slot.live = true;
+    handle.generation = slot.generation;
+    
+    TextLine &line = slot.line;
+    line.text = s;
+    line.properties = properties;
+    line.baked = bake_lines;
+    add_glyphs(&line, glyphs);
+    draw_glyphs(&line, 0);
+    
+    return handle;
+}
+
+void WriteTextScene::replace_text(LineHandle handle, size_t begin, size_t end, std::string const &utf8) {
+    TextLine &line = this->line(handle);
+    if (!(begin <= end && end <= line.text.size())) {
+        throw std::runtime_error("WriteTextScene::replace_text range is outside the line's text");
+    }
+    line.text.replace(begin, end - begin, utf8);
+    
+    // Keep the glyphs before the last safe place to break that comes before the edit, and never the cluster right
+    // before the edit (same reasoning as reusing a prefix in shape()). Only for left-to-right lines, since that's
+    // when glyph order follows the text.
+    size_t keep = 0;
+    if (line.properties.direction == HB_DIRECTION_LTR) {
+        for (size_t i = line.glyphs.size(); i-- > 1;) {
+            TextLine::Glyph const &glyph = line.glyphs[i];
+            bool starts_cluster = line.glyphs[i - 1].cluster != glyph.cluster;
+            if (glyph.cluster < begin && starts_cluster && !glyph.unsafe_to_break) {
+                keep = i;
+                break;
             }
-            std::string name(buf);
-            
-            transform->parent = &line.base;
-            transform->position.x = x + PIXEL_SCALE * (float) pos[i].x_offset / 64.0f;
-            transform->position.y = y + PIXEL_SCALE * (float) pos[i].y_offset / 64.0f;
-            // gotta love the &* operator
-            write_glyph_at(&*transform, name);
-            
-            x += PIXEL_SCALE * (float) pos[i].x_advance / 64.0f;
-            y += PIXEL_SCALE * (float) pos[i].y_advance / 64.0f;
         }
     }
     
-    hb_buffer_destroy(buffer);
+    // shape the rest (HarfBuzz still sees the text before it as context)
+    std::vector<ShapedGlyph> shaped;
+    if (keep != 0) {
+        uint32_t start = line.glyphs[keep].cluster;
+        hb_segment_properties_t properties = guess_properties(line.text, start);
+        if (properties.script == line.properties.script || properties.script == HB_SCRIPT_INVALID) {
+            shape_runs(line.text, start, line.properties, &shaped);
+        } else {
+            // the edit changes how the whole line should be shaped
+            keep = 0;
+        }
+    }
+    
+    undraw_glyphs(&line, keep);
+    line.glyphs.resize(keep);
+    if (keep == 0) {
+        ShapedRun const &run = shape(line.text);
+        line.properties = run.properties;
+        add_glyphs(&line, run.glyphs);
+    } else {
+        add_glyphs(&line, shaped);
+    }
+    draw_glyphs(&line, keep);
+}
+
+void WriteTextScene::append_codepoint(LineHandle handle, uint32_t codepoint) {
+    // UTF-8 encode:
+    std::string utf8;
+    if (codepoint < 0x80) {
+        utf8 += (char) codepoint;
+    } else if (codepoint < 0x800) {
+        utf8 += (char) (0xc0 | (codepoint >> 6));
+        utf8 += (char) (0x80 | (codepoint & 0x3f));
+    } else if (codepoint < 0x10000) {
+        utf8 += (char) (0xe0 | (codepoint >> 12));
+        utf8 += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        utf8 += (char) (0x80 | (codepoint & 0x3f));
+    } else {
+        utf8 += (char) (0xf0 | (codepoint >> 18));
+        utf8 += (char) (0x80 | ((codepoint >> 12) & 0x3f));
+        utf8 += (char) (0x80 | ((codepoint >> 6) & 0x3f));
+        utf8 += (char) (0x80 | (codepoint & 0x3f));
+    }
+    size_t size = line(handle).text.size();
+    replace_text(handle, size, size, utf8);
+}
+
+void WriteTextScene::pop_codepoint(LineHandle handle) {
+    std::string const &text = line(handle).text;
+    if (text.empty()) return;
+    // back up over UTF-8 continuation bytes (10xxxxxx) to the start of the last codepoint
+    size_t begin = text.size() - 1;
+    while (begin > 0 && (text[begin] & 0xc0) == 0x80) begin--;
+    replace_text(handle, begin, text.size(), "");
+}
+
+void WriteTextScene::erase_line(LineHandle handle) {
+    if (!contains(handle)) return;
+    LineSlot &slot = line_slots[handle.slot];
+    TextLine &line = slot.line;
+    
+    undraw_glyphs(&line, 0);
+    
+    // leave the line as write_line expects to find it (vectors keep their storage for the next line in the slot):
+    line.transforms.clear();
+    line.batches.clear();
+    line.glyphs.clear();
+    line.text.clear();
+    line.waiting = false;
+    line.base.name.clear();
+    line.base.position = glm::vec3(0.0f);
+    line.base.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    line.base.scale = glm::vec3(1.0f);
+    line.base.parent = nullptr;
+    
+    // retire the handle:
+    slot.live = false;
+    slot.generation += 1;
+    slot.next_free = free_line_slot;
+    free_line_slot = handle.slot;
+}
+
+bool WriteTextScene::contains(ParagraphHandle handle) const {
+    return handle.slot < paragraph_slots.size()
+           && paragraph_slots[handle.slot].live
+           && paragraph_slots[handle.slot].generation == handle.generation;
+}
+
+WriteTextScene::Paragraph &WriteTextScene::paragraph(ParagraphHandle handle) {
+    if (!contains(handle)) {
+        throw std::runtime_error("WriteTextScene paragraph handle is not valid (was the paragraph erased?)");
+    }
+    return paragraph_slots[handle.slot].paragraph;
+}
+
+// Finds the places a run could break: right after spaces, where HarfBuzz says it's safe to break (so the glyphs on
+// either side are the same as if each side was shaped on its own). Only for left-to-right runs.
+static void find_breaks(std::string const &text, WriteTextScene::Paragraph::Run *run_) {
+    auto &run = *run_;
+    auto is_space = [&](uint32_t cluster) {
+        return cluster < text.size() && (text[cluster] == ' ' || text[cluster] == '\t');
+    };
+    bool ltr = run.properties.direction == HB_DIRECTION_LTR;
+    
+    run.breaks.clear();
+    float x = 0.0f;
+    float content_end = 0.0f;
+    for (size_t i = 0; i < run.glyphs.size(); i++) {
+        WriteTextScene::ShapedGlyph const &glyph = run.glyphs[i];
+        bool starts_cluster = i > 0 && run.glyphs[i - 1].cluster != glyph.cluster;
+        if (ltr && starts_cluster && !glyph.unsafe_to_break && glyph.cluster > 0
+            && is_space(glyph.cluster - 1) && !is_space(glyph.cluster)) {
+            run.breaks.push_back(WriteTextScene::Paragraph::Break{(uint32_t) i, x, content_end});
+        }
+        x += PIXEL_SCALE * (float) glyph.x_advance / 64.0f;
+        if (!is_space(glyph.cluster)) content_end = x;
+    }
+    run.breaks.push_back(WriteTextScene::Paragraph::Break{(uint32_t) run.glyphs.size(), x, content_end});
+}
+
+WriteTextScene::ParagraphHandle WriteTextScene::write_paragraph(std::string const &s, ParagraphStyle const &style) {
+    // find a slot for the paragraph:
+    ParagraphHandle handle;
+    if (free_paragraph_slot != -1U) {
+        handle.slot = free_paragraph_slot;
+        free_paragraph_slot = paragraph_slots[handle.slot].next_free;
+    } else {
+        handle.slot = (uint32_t) paragraph_slots.size();
+        paragraph_slots.emplace_back();
+    }
+    ParagraphSlot &slot = paragraph_slots[handle.slot];
+    slot.live = true;
+    handle.generation = slot.generation;
+    
+    Paragraph &paragraph = slot.paragraph;
+    paragraph.text = s;
+    paragraph.style = style;
+    
+    // shape each line of text once; layout only ever re-uses these glyphs
+    size_t begin = 0;
+    while (true) {
+        size_t end = std::min(s.find('\n', begin), s.size());
+        paragraph.runs.emplace_back();
+        Paragraph::Run &run = paragraph.runs.back();
+        run.begin = begin;
+        run.end = end;
+        std::string text = s.substr(begin, end - begin);
+        ShapedRun const &shaped = shape(text);
+        run.properties = shaped.properties;
+        run.glyphs = shaped.glyphs;
+        find_breaks(text, &run);
+        if (end == s.size()) break;
+        begin = end + 1;
+    }
     
-    return &line.base;
+    layout_paragraph(&paragraph);
+    return handle;
+}
+
+void WriteTextScene::set_paragraph_style(ParagraphHandle handle, ParagraphStyle const &style) {
+    Paragraph &paragraph = this->paragraph(handle);
+    paragraph.style = style;
+    layout_paragraph(&paragraph);
 }
 
-void WriteTextScene::erase_line(Scene::Transform *transform) {
-    for (TextLine &line: lines) {
-        if (&line.base == transform) {
-            for (Transform &t: line.transforms) {
-                erase_glyph_at(&t);
+void WriteTextScene::layout_paragraph(Paragraph *paragraph_) {
+    auto &paragraph = *paragraph_;
+    ParagraphStyle const &style = paragraph.style;
+    
+    // Greedy line breaking: each line takes as many breaks as fit in the width (and always at least one).
+    std::vector<Paragraph::Line> lines;
+    for (uint32_t r = 0; r < paragraph.runs.size(); r++) {
+        Paragraph::Run const &run = paragraph.runs[r];
+        uint32_t begin = 0;
+        float begin_x = 0.0f;
+        Paragraph::Break const *fit = nullptr; // last break that fits on the current line
+        for (Paragraph::Break const &b: run.breaks) {
+            if (fit && b.content_end - begin_x > style.width) {
+                lines.push_back(Paragraph::Line{LineHandle(), r, begin, fit->glyph, fit->content_end - begin_x});
+                begin = fit->glyph;
+                begin_x = fit->x;
             }
+            fit = &b;
+        }
+        lines.push_back(Paragraph::Line{LineHandle(), r, begin, (uint32_t) run.glyphs.size(),
+                                        run.breaks.back().content_end - begin_x});
+    }
+    
+    // Lines that break in the same places as before keep their glyphs:
+    std::map<std::tuple<uint32_t, uint32_t, uint32_t>, LineHandle> old_lines;
+    for (Paragraph::Line const &line: paragraph.lines) {
+        old_lines.emplace(std::make_tuple(line.run, line.begin, line.end), line.handle);
+    }
+    
+    float box_width = style.width;
+    if (!std::isfinite(box_width)) {
+        box_width = 0.0f;
+        for (Paragraph::Line const &line: lines) {
+            box_width = std::max(box_width, line.width);
         }
     }
-    lines.remove_if([transform](TextLine &line) {
-        return &line.base == transform;
-    });
+    float line_advance = font->line_height() * style.line_spacing;
+    
+    paragraph.min = glm::vec2(std::numeric_limits<float>::infinity(), 0.0f);
+    paragraph.max = glm::vec2(-std::numeric_limits<float>::infinity(), 0.0f);
+    for (size_t l = 0; l < lines.size(); l++) {
+        Paragraph::Line &line = lines[l];
+        Paragraph::Run const &run = paragraph.runs[line.run];
+        
+        auto old = old_lines.find(std::make_tuple(line.run, line.begin, line.end));
+        if (old != old_lines.end()) {
+            line.handle = old->second;
+            old_lines.erase(old);
+        } else {
+            // the line's text starts at its first glyph's cluster (runs that can break are left-to-right, so
+            // clusters go up along the run; runs that can't are one line, whichever way their clusters go)
+            uint32_t text_begin = line.begin == 0 ? 0 : run.glyphs[line.begin].cluster;
+            uint32_t text_end = line.end == run.glyphs.size() ? (uint32_t) (run.end - run.begin)
+                                                              : run.glyphs[line.end].cluster;
+            std::vector<ShapedGlyph> glyphs(run.glyphs.begin() + line.begin, run.glyphs.begin() + line.end);
+            for (ShapedGlyph &glyph: glyphs) {
+                glyph.cluster -= text_begin;
+            }
+            line.handle = write_shaped_line(paragraph.text.substr(run.begin + text_begin, text_end - text_begin),
+                                            run.properties, glyphs);
+        }
+        
+        float x = 0.0f;
+        if (style.align == ParagraphStyle::Center) x = 0.5f * (box_width - line.width);
+        else if (style.align == ParagraphStyle::Right) x = box_width - line.width;
+        float y = -font->ascender - (float) l * line_advance;
+        
+        Transform *transform = line_transform(line.handle);
+        transform->parent = &paragraph.base;
+        transform->position = glm::vec3(x, y, 0.0f);
+        
+        paragraph.min.x = std::min(paragraph.min.x, x);
+        paragraph.max.x = std::max(paragraph.max.x, x + line.width);
+        paragraph.min.y = y + font->descender;
+    }
+    
+    for (auto const &old: old_lines) {
+        erase_line(old.second);
+    }
+    paragraph.lines.swap(lines);
+}
+
+void WriteTextScene::erase_paragraph(ParagraphHandle handle) {
+    if (!contains(handle)) return;
+    ParagraphSlot &slot = paragraph_slots[handle.slot];
+    Paragraph &paragraph = slot.paragraph;
+    
+    for (Paragraph::Line const &line: paragraph.lines) {
+        erase_line(line.handle);
+    }
+    
+    // leave the paragraph as write_paragraph expects to find it:
+    paragraph.lines.clear();
+    paragraph.runs.clear();
+    paragraph.text.clear();
+    paragraph.base.name.clear();
+    paragraph.base.position = glm::vec3(0.0f);
+    paragraph.base.rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    paragraph.base.scale = glm::vec3(1.0f);
+    paragraph.base.parent = nullptr;
+    
+    // retire the handle:
+    slot.live = false;
+    slot.generation += 1;
+    slot.next_free = free_paragraph_slot;
+    free_paragraph_slot = handle.slot;
 }
@@ -1,23 +1,291 @@
 #pragma once
 
 #include "WriteGlyphScene.hpp"
+#include "BufferArena.hpp"
+
+#include <deque>
+#include <limits>
+#include <map>
+#include <unordered_map>
 
 struct TextLine {
     Scene::Transform base;
-    std::list<Scene::Transform> transforms;
+    std::list<Scene::Transform> transforms; // one per glyph, in glyph order (unless the line is baked)
+    
+    // What the line says and where its glyphs went, so that edits only have to redo the end of the line:
+    std::string text;
+    hb_segment_properties_t properties{};
+    struct Glyph {
+        uint32_t glyph = 0; // glyph index
+        uint8_t font = 0; // which font in the scene's chain the glyph is from (see WriteGlyphScene::chain_font)
+        uint32_t cluster = 0; // byte offset (in text) of the text this glyph came from
+        bool unsafe_to_break = false;
+        glm::vec2 pen = glm::vec2(0.0f); // pen position before this glyph, relative to base
+        glm::vec2 offset = glm::vec2(0.0f); // where the glyph goes relative to the pen
+        glm::vec2 advance = glm::vec2(0.0f); // how far the pen moves after it
+        uint32_t batch = -1U; // baked: which batch holds the glyph's quad (-1U if it has none)
+        uint32_t vertex = 0; // baked: first vertex of the quad in its batch
+    };
+    std::vector<Glyph> glyphs;
+    
+    // Baked lines (see WriteTextScene::bake_lines) have no glyph transforms, just a vertex range per atlas page
+    // (quads in glyph order, with room to grow so typing doesn't move the range every time):
+    bool baked = false;
+    struct Batch {
+        std::list<Scene::Drawable>::iterator drawable;
+        GLuint texture = 0;
+        size_t start = 0, count = 0, capacity = 0; // in WriteTextScene::text_vertices
+    };
+    std::vector<Batch> batches;
+    // With a glyph cache, baked lines hold on to their glyphs (so they stay in the atlas) and get baked again once
+    // the glyphs that weren't rasterized yet are:
+    bool waiting = false;
+};
+
+// How WriteTextScene::write_paragraph lays out text:
+struct ParagraphStyle {
+    // Lines break (at spaces) to fit this width, in the same units as glyphs. A word that's wider gets a line to
+    // itself; right-to-left text doesn't get broken.
+    float width = std::numeric_limits<float>::infinity();
+    // Lines are aligned within width (or within the widest line, if width is infinite):
+    enum Align : uint8_t {
+        Left,
+        Center,
+        Right
+    } align = Left;
+    // Distance between baselines, as a multiple of the font's line height:
+    float line_spacing = 1.0f;
 };
 
 struct WriteTextScene : WriteGlyphScene {
-    hb_font_t *font;
-    std::list<TextLine> lines;
-    
+    // Shares the scene's font (so text scenes are as cheap to make as any other copy of a scene).
     explicit WriteTextScene(const WriteGlyphScene &scene);
     
     ~WriteTextScene();
     
-    // Returns a Transform* that refers to base of the TextLine, which can be used to identify what to erase later.
-    Transform *write_line(std::string const &s);
+    // Lines are referred to by handle; a handle stays valid until its line is erased (and never becomes valid again,
+    // even once its slot holds a different line).
+    struct LineHandle {
+        uint32_t slot = -1U;
+        uint32_t generation = 0;
+        
+        bool operator==(LineHandle const &other) const { return slot == other.slot && generation == other.generation; }
+        
+        bool operator!=(LineHandle const &other) const { return !(*this == other); }
+    };
+    
+    // Writes a line of text; move it around with line_transform().
+    LineHandle write_line(std::string const &s);
+    
+    // Erases the TextLine (does nothing for handles that aren't valid, e.g. a default LineHandle).
+    // Takes time proportional to the glyphs in the line, no matter how big the scene is.
+    void erase_line(LineHandle handle);
+    
+    // Edit a line in place. Only the glyphs from the last place HarfBuzz says it's safe to break the text before the
+    // edit get shaped and drawn again, so typing at the end of a line costs the same however long the line is.
+    // (Edits in the middle redo everything after them, since those glyphs move; right-to-left lines are redone whole.)
+    // Offsets are bytes of UTF-8; will throw if the handle isn't valid or the range is outside the text.
+    void replace_text(LineHandle handle, size_t begin, size_t end, std::string const &utf8);
+    
+    void append_codepoint(LineHandle handle, uint32_t codepoint);
+    
+    // (does nothing to an empty line)
+    void pop_codepoint(LineHandle handle);
+    
+    bool contains(LineHandle handle) const;
+    
+    // The line itself; note: will throw if the handle isn't valid.
+    TextLine &line(LineHandle handle);
+    
+    // Base transform of the line, which its glyphs are positioned relative to:
+    Transform *line_transform(LineHandle handle) { return &line(handle).base; }
+    
+    // Paragraphs are written as lines (breaking at '\n', and to fit style.width) positioned under one transform:
+    struct ParagraphHandle {
+        uint32_t slot = -1U;
+        uint32_t generation = 0;
+        
+        bool operator==(ParagraphHandle const &other) const {
+            return slot == other.slot && generation == other.generation;
+        }
+        
+        bool operator!=(ParagraphHandle const &other) const { return !(*this == other); }
+    };
+    
+    // Writes a paragraph; its box's top left corner is at the paragraph transform, and its bounds are in
+    // paragraph(handle).min and max.
+    ParagraphHandle write_paragraph(std::string const &s, ParagraphStyle const &style = ParagraphStyle());
+    
+    // Lays the paragraph out again with a new style. The text isn't shaped again, and lines that break in the same
+    // places are only moved, so this is cheap enough to do every frame (e.g. while a box is being resized).
+    void set_paragraph_style(ParagraphHandle handle, ParagraphStyle const &style);
+    
+    // Erases the paragraph and its lines (does nothing for handles that aren't valid).
+    void erase_paragraph(ParagraphHandle handle);
+    
+    bool contains(ParagraphHandle handle) const;
+    
+    // Line storage; slots of erased lines are re-used by later lines.
+    // (A deque, so lines never move: glyph transforms and drawables point at them.)
+    struct LineSlot {
+        TextLine line;
+        uint32_t generation = 0;
+        bool live = false;
+        uint32_t next_free = -1U; // next free slot, when not live
+    };
+    std::deque<LineSlot> line_slots;
+    uint32_t free_line_slot = -1U;
+    
+    // When true, write_line bakes the whole line into one vertex range (glyph quads already moved to their
+    // positions), drawn by one Drawable on the line's base transform; otherwise each glyph gets a transform.
+    // (A line whose glyphs are on more than one atlas page gets a range and Drawable per page.)
+    // Only affects lines written after it is changed.
+    bool bake_lines = true;
+    
+    // same layout as the .pnct files render-glyphs writes, so baked lines draw with glyph_program:
+    struct TextVertex {
+        glm::vec3 Position;
+        glm::vec3 Normal;
+        glm::u8vec4 Color;
+        glm::vec2 TexCoord;
+    };
+    static_assert(sizeof(TextVertex) == 3 * 4 + 3 * 4 + 4 * 1 + 2 * 4, "TextVertex is packed.");
+    
+    // vertices of all baked lines, and vertex array objects for drawing them with each font's glyph program
+    // (made as fonts need them; attribute locations can differ between programs):
+    BufferArena text_vertices;
+    std::map<LitColorTextureProgram const *, GLuint> text_vaos;
+    
+    GLuint text_vao_for(LitColorTextureProgram const *program);
+    
+    // What HarfBuzz makes of a string, minus the HarfBuzz buffer:
+    struct ShapedGlyph {
+        uint32_t glyph; // glyph index
+        uint8_t font; // which font in the chain
+        uint32_t cluster; // byte offset (in the string) of the text this glyph came from
+        bool unsafe_to_break; // HarfBuzz says the text can't be split right before this glyph
+        hb_position_t x_advance, y_advance, x_offset, y_offset;
+    };
+    struct ShapedRun {
+        hb_segment_properties_t properties;
+        std::vector<ShapedGlyph> glyphs;
+    };
+    
+    // A paragraph keeps its text shaped (one run per line of text), along with where each run could break, and the
+    // lines it is currently laid out as. Its lines are the scene's lines, so edit the paragraph, not them.
+    struct Paragraph {
+        Transform base;
+        std::string text;
+        ParagraphStyle style;
+        
+        struct Break {
+            uint32_t glyph = 0; // first glyph on the next line
+            float x = 0.0f; // pen position at glyph, from the start of the run
+            float content_end = 0.0f; // pen position after the last glyph before it that isn't a space
+        };
+        struct Run {
+            size_t begin = 0, end = 0; // byte range in text (not including the '\n')
+            hb_segment_properties_t properties{};
+            std::vector<ShapedGlyph> glyphs; // clusters are offsets from begin
+            std::vector<Break> breaks; // in glyph order; the last one is the end of the run
+        };
+        std::vector<Run> runs;
+        
+        struct Line {
+            LineHandle handle;
+            uint32_t run = 0;
+            uint32_t begin = 0, end = 0; // range of the run's glyphs
+            float width = 0.0f; // not counting spaces at the end
+        };
+        std::vector<Line> lines;
+        
+        // bounds of the lines, relative to base (the top of the first line's ascender is at y = 0):
+        glm::vec2 min = glm::vec2(0.0f);
+        glm::vec2 max = glm::vec2(0.0f);
+    };
+    
+    // The paragraph itself; note: will throw if the handle isn't valid.
+    Paragraph &paragraph(ParagraphHandle handle);
+    
+    Transform *paragraph_transform(ParagraphHandle handle) { return &paragraph(handle).base; }
+    
+    // Paragraph storage (same scheme as line_slots):
+    struct ParagraphSlot {
+        Paragraph paragraph;
+        uint32_t generation = 0;
+        bool live = false;
+        uint32_t next_free = -1U;
+    };
+    std::deque<ParagraphSlot> paragraph_slots;
+    uint32_t free_paragraph_slot = -1U;
+    
+    // Breaks the paragraph's runs into lines for its style, and writes, moves, or erases lines to match:
+    void layout_paragraph(Paragraph *paragraph);
+    
+    // Writes a line from glyphs that are already shaped (write_line is shape() and then this):
+    LineHandle write_shaped_line(std::string const &s, hb_segment_properties_t const &properties,
+                                 std::vector<ShapedGlyph> const &glyphs);
+    
+    // Strings might shape differently with another font in the chain, so this also clears the shape cache:
+    void add_fallback_font(std::shared_ptr<Font> fallback) override;
+    
+    // Splits s into runs of the font chain, starting at byte 'start', and shapes each run with its font (HarfBuzz
+    // still sees all of s as context), appending the glyphs in visual order. Codepoints go to the first font that has
+    // them, except that marks and spaces stay with the run they're in when its font has them.
+    void shape_runs(std::string const &s, uint32_t start, hb_segment_properties_t const &properties,
+                    std::vector<ShapedGlyph> *glyphs);
+    
+    // What HarfBuzz guesses s is (direction, script, language), from byte 'start' on:
+    hb_segment_properties_t guess_properties(std::string const &s, uint32_t start);
+    
+    // Shapes a string, or gets it from the shape cache. Strings that start with a cached string only shape the end.
+    // The result is only good until the next call. (The cache is the scene's, so this is for the GL thread; other
+    // threads can shape with font->shape directly.)
+    ShapedRun const &shape(std::string const &s);
+    
+    // Lays out shaped glyphs on the end of line->glyphs, continuing from the pen position after the last one:
+    void add_glyphs(TextLine *line, std::vector<ShapedGlyph> const &shaped);
+    
+    // Draws line->glyphs from 'first' on (as baked quads or as glyph transforms), or takes them away again:
+    void draw_glyphs(TextLine *line, size_t first);
+    
+    void undraw_glyphs(TextLine *line, size_t first);
+    
+    // Also re-bakes lines that were waiting on glyphs the cache has finished:
+    void update_glyph_cache() override;
+    
+    // Also leaves out baked lines' drawables (which are on the lines' base transforms):
+    bool copy_drawable(Drawable const &drawable) const override;
+    
+    uint32_t glyphs_serial = 0; // total of the chain's Font::glyphs_serial as of the last re-bake
+    
+    // Least-recently-used cache of shaped strings, most recent first:
+    size_t shape_cache_capacity = 256;
+    struct ShapeKey {
+        hb_font_t const *font;
+        std::string text;
+        
+        bool operator==(ShapeKey const &other) const { return font == other.font && text == other.text; }
+    };
+    struct ShapeKeyHash {
+        size_t operator()(ShapeKey const &key) const {
+            return std::hash<std::string>()(key.text) ^ std::hash<hb_font_t const *>()(key.font);
+        }
+    };
+    std::list<std::pair<ShapeKey, ShapedRun>> shape_lru;
+    std::unordered_map<ShapeKey, std::list<std::pair<ShapeKey, ShapedRun>>::iterator, ShapeKeyHash> shape_cache;
+    
+    // counts since construction, handy for checking that the cache is working:
+    struct ShapeStats {
+        uint32_t hits = 0; // string was already shaped
+        uint32_t prefix_hits = 0; // reused the start of a cached string and only shaped the rest
+        uint32_t misses = 0; // shaped the whole string
+    } shape_stats;
+    
+    // HarfBuzz buffers get reused instead of created and destroyed for every string:
+    std::vector<hb_buffer_t *> buffer_pool;
+    
+    hb_buffer_t *acquire_buffer();
     
-    // Erases the TextLine
-    void erase_line(Transform *transform);
+    void release_buffer(hb_buffer_t *buffer);
 };
@@ -0,0 +1,146 @@
+/*
+ * This program measures how many playing samples ("voices") the audio callback can mix,
+ * comparing the old one-sample-at-a-time loop against each mixing kernel this machine can run.
+ *
+ * Voices are looping noise of different lengths (so spans break at loop points at different
+ * places) with pan ramping across every block, which is what moving 3D sounds look like to the mixer.
+ *
+ * usage: bench-mix [voices ...]   (defaults to 16 64 256 1024)
+ */
+
+#include "mix_span.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+//same as Sound.cpp:
+constexpr uint32_t const AUDIO_RATE = 48000;
+constexpr uint32_t const MIX_SAMPLES = 1024;
+
+constexpr uint32_t const BLOCKS = 200; //blocks (audio callbacks) mixed per timing round
+
+struct Voice {
+    std::vector<float> const *data;
+    uint32_t i;
+    float left, right, left_step, right_step;
+};
+
+//the loop mix_audio used before the kernels (wrap check and pan step on every sample):
+static void mix_per_sample(Voice &voice, float *out) {
+    float left = voice.left;
+    float right = voice.right;
+    for (uint32_t i = 0; i < MIX_SAMPLES; ++i) {
+        out[2 * i + 0] += left * (*voice.data)[voice.i];
+        out[2 * i + 1] += right * (*voice.data)[voice.i];
+        voice.i += 1;
+        if (voice.i == voice.data->size()) voice.i = 0;
+        left += voice.left_step;
+        right += voice.right_step;
+    }
+}
+
+//same span loop as mix_audio:
+static void mix_spans(MixKernel const &kernel, Voice &voice, float *out) {
+    for (uint32_t mixed = 0; mixed < MIX_SAMPLES; /* later */) {
+        uint32_t count = std::min(MIX_SAMPLES - mixed, uint32_t(voice.data->size() - voice.i));
+        kernel.mix(voice.data->data() + voice.i, count, out + 2 * mixed,
+                   voice.left + float(mixed) * voice.left_step, voice.right + float(mixed) * voice.right_step,
+                   voice.left_step, voice.right_step);
+        mixed += count;
+        voice.i += count;
+        if (voice.i == voice.data->size()) voice.i = 0;
+    }
+}
+
+//run 'fn' a few times, return best time in milliseconds:
+template<typename F>
+static double time_best(F const &fn) {
+    double best = std::numeric_limits<double>::infinity();
+    for (uint32_t round = 0; round < 5; ++round) {
+        auto before = std::chrono::high_resolution_clock::now();
+        fn();
+        auto after = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(after - before).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    std::vector<uint32_t> counts;
+    for (int a = 1; a < argc; ++a) {
+        counts.emplace_back(uint32_t(std::stoul(argv[a])));
+    }
+    if (counts.empty()) counts = {16, 64, 256, 1024};
+    
+    //pick mix_span's kernel the same way Sound::init does:
+    std::cout << "mix_span uses " << select_mix_kernel().name << "\n";
+    
+    //a handful of samples, 0.2 to 1.2 seconds long:
+    std::mt19937 mt(0x15466);
+    std::uniform_real_distribution<float> noise(-1.0f, 1.0f);
+    std::vector<std::vector<float>> samples(8);
+    for (auto &sample: samples) {
+        sample.resize(AUDIO_RATE / 5 + mt() % AUDIO_RATE);
+        for (float &s: sample) {
+            s = noise(mt);
+        }
+    }
+    
+    double block_ms = 1000.0 * double(MIX_SAMPLES) / double(AUDIO_RATE);
+    std::cout << "voices, mixer, voice-blocks per ms, voices per callback (" << block_ms << " ms budget)\n";
+    
+    std::vector<float> out(2 * MIX_SAMPLES);
+    float sink = 0.0f; //keep results live so the work isn't optimized away
+    
+    for (uint32_t count: counts) {
+        std::vector<Voice> voices;
+        for (uint32_t v = 0; v < count; ++v) {
+            Voice voice;
+            voice.data = &samples[v % samples.size()];
+            voice.i = uint32_t(mt() % voice.data->size());
+            voice.left = noise(mt);
+            voice.right = noise(mt);
+            voice.left_step = noise(mt) / MIX_SAMPLES;
+            voice.right_step = noise(mt) / MIX_SAMPLES;
+            voices.emplace_back(voice);
+        }
+        
+        auto report = [&](std::string const &name, double ms) {
+            double per_ms = double(count) * BLOCKS / ms;
+            std::cout << count << ", " << name << ", " << per_ms << ", " << size_t(per_ms * block_ms)
+                      << "   (checksum " << sink << ")\n";
+        };
+        
+        report("per-sample", time_best([&]() {
+            for (uint32_t b = 0; b < BLOCKS; ++b) {
+                std::fill(out.begin(), out.end(), 0.0f);
+                for (Voice &voice: voices) {
+                    mix_per_sample(voice, out.data());
+                }
+                sink += out[b % out.size()];
+            }
+        }));
+        
+        //each kernel, then mix_span (the picked kernel, through the pointer the audio callback calls):
+        std::vector<MixKernel> kernels = mix_kernels();
+        kernels.emplace_back(MixKernel{"mix_span", mix_span});
+        for (MixKernel const &kernel: kernels) {
+            report(kernel.name, time_best([&]() {
+                for (uint32_t b = 0; b < BLOCKS; ++b) {
+                    std::fill(out.begin(), out.end(), 0.0f);
+                    for (Voice &voice: voices) {
+                        mix_spans(kernel, voice, out.data());
+                    }
+                    sink += out[b % out.size()];
+                }
+            }));
+        }
+    }
+    
+    return 0;
+}
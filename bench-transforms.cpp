@@ -0,0 +1,106 @@
+/*
+ * This program times world-matrix updates for large transform hierarchies in Scene's
+ * std::list< Scene::Transform >, with and without a Scene::Transform::Frozen cache.
+ *
+ * Each round moves every transform (so no cached matrix can be reused) and then
+ * computes every local-to-world matrix, which is the worst case for a frame.
+ *
+ * usage: bench-transforms [count ...]   (defaults to 10000 100000 1000000)
+ */
+
+#include "Scene.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+//random hierarchy in topological order; parent index or -1U for roots:
+static std::vector<uint32_t> make_hierarchy(uint32_t count) {
+    constexpr uint32_t MaxDepth = 6; //about as deep as real scenes (e.g. glyph -> line -> object -> ...)
+    std::mt19937 mt(0x15466);
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> depths;
+    parents.reserve(count);
+    depths.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        //attach to a recent transform if that doesn't make the hierarchy too deep:
+        uint32_t parent = -1U;
+        if (i > 0 && mt() % 8 != 0) {
+            uint32_t window = std::min(i, 64U);
+            parent = i - 1 - uint32_t(mt() % window);
+            if (depths[parent] + 1 >= MaxDepth) parent = -1U;
+        }
+        parents.emplace_back(parent);
+        depths.emplace_back(parent == -1U ? 0 : depths[parent] + 1);
+    }
+    return parents;
+}
+
+//run 'fn' a few times, return best time in milliseconds:
+template<typename F>
+static double time_best(F const &fn) {
+    double best = std::numeric_limits<double>::infinity();
+    for (uint32_t round = 0; round < 5; ++round) {
+        auto before = std::chrono::high_resolution_clock::now();
+        fn(round);
+        auto after = std::chrono::high_resolution_clock::now();
+        best = std::min(best, std::chrono::duration<double, std::milli>(after - before).count());
+    }
+    return best;
+}
+
+int main(int argc, char **argv) {
+    std::vector<uint32_t> counts;
+    for (int a = 1; a < argc; ++a) {
+        counts.emplace_back(uint32_t(std::stoul(argv[a])));
+    }
+    if (counts.empty()) counts = {10000, 100000, 1000000};
+    
+    std::cout << "count, list (ms), list+freeze (ms)\n";
+    
+    for (uint32_t count: counts) {
+        std::vector<uint32_t> parents = make_hierarchy(count);
+        
+        //list-based scene:
+        Scene scene;
+        std::vector<Scene::Transform *> list_transforms;
+        list_transforms.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            scene.transforms.emplace_back();
+            Scene::Transform &t = scene.transforms.back();
+            if (parents[i] != -1U) t.parent = list_transforms[parents[i]];
+            t.position = glm::vec3(float(i % 100), 0.0f, 0.0f);
+            list_transforms.emplace_back(&t);
+        }
+        
+        //keep results live so the work isn't optimized away:
+        float sink = 0.0f;
+        
+        double list_ms = time_best([&](uint32_t round) {
+            for (auto &t: scene.transforms) {
+                t.position.y = float(round);
+            }
+            for (auto const &t: scene.transforms) {
+                sink += t.make_local_to_world()[3].x;
+            }
+        });
+        
+        double frozen_ms = time_best([&](uint32_t round) {
+            for (auto &t: scene.transforms) {
+                t.position.y = float(round) + 0.5f;
+            }
+            Scene::Transform::Frozen frozen;
+            for (auto const &t: scene.transforms) {
+                sink += t.make_local_to_world()[3].x;
+            }
+        });
+        
+        std::cout << count << ", " << list_ms << ", " << frozen_ms << "   (checksum " << sink << ")\n";
+    }
+    
+    return 0;
+}
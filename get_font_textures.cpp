@@ -1,71 +1,122 @@
 #include "get_font_textures.hpp"
 #include "read_write_chunk.hpp"
+#include "MappedFile.hpp"
 #include "gl_errors.hpp"
-#include <fstream>
+#include <zlib.h>
+#include <stdexcept>
 
 // modeled after Mesh.cpp
 
-std::map<std::string, GLuint> get_font_textures(std::string const &filename) {
+std::map<std::string, GLuint> get_font_textures(std::string const &filename,
+                                                std::map<std::string, glm::vec4> *tex_rects_,
+                                                float *distance_spread_) {
     std::map<std::string, GLuint> textures;
     
-    std::ifstream file(filename, std::ios::binary);
+    MappedFile file(filename);
+    char const *at = file.begin();
     
-    GLuint total = 0;
+    // files from before the header chunk existed start right in with the (uncompressed RGBA-era) pixels
+    if (size_t(file.end() - at) >= 4 && std::string(at, 4) == "txtr") {
+        throw std::runtime_error("'" + filename + "' is an old unversioned .txtr; re-run render-glyphs");
+    }
     
-    std::vector<uint8_t> data;
-    // I copy all the alpha values to here because OpenGL understands RGBA but not just A
-    std::vector<uint8_t> colors;
+    ChunkView<TxtrHeader> header_chunk = view_chunk<TxtrHeader>(&at, file.end(), "txh0");
+    if (header_chunk.size() != 1) {
+        throw std::runtime_error("'" + filename + "' should have exactly one header");
+    }
+    TxtrHeader header = header_chunk[0];
+    if (header.version != TXTR_VERSION || header.channels != 1) {
+        throw std::runtime_error("'" + filename + "' is .txtr version " + std::to_string(header.version)
+                                 + " (expected " + std::to_string(TXTR_VERSION) + "); re-run render-glyphs");
+    }
+    if (distance_spread_) *distance_spread_ = header.distance_spread;
     
-    if (filename.size() >= 5 && filename.substr(filename.size() - 5) == ".txtr") {
-        read_chunk(file, "txtr", &data);
-        
-        for (uint8_t alpha: data) {
-            colors.push_back(0);
-            colors.push_back(0);
-            colors.push_back(0);
-            colors.push_back(alpha);
+    // coverage (or distance) is one byte per pixel; the textures below turn it into alpha with a swizzle, so it never
+    // gets expanded to RGBA on the CPU
+    std::vector<uint8_t> data(header.pixel_bytes);
+    {
+        ChunkView<uint8_t> compressed = view_chunk<uint8_t>(&at, file.end(), "txz0");
+        uLongf size = (uLongf) data.size();
+        if (uncompress(data.data(), &size, reinterpret_cast< Bytef const * >(compressed.data),
+                       (uLong) compressed.size()) != Z_OK || size != data.size()) {
+            throw std::runtime_error("'" + filename + "' has corrupt compressed pixels");
+        }
+    }
+    GLuint total = GLuint(data.size());
+    
+    struct AtlasPage {
+        uint32_t tex_begin, tex_end;
+        uint32_t width, height;
+    };
+    static_assert(sizeof(AtlasPage) == 16, "AtlasPage should be packed");
+    
+    ChunkView<AtlasPage> pages = view_chunk<AtlasPage>(&at, file.end(), "pag0");
+    
+    // one texture per page, shared by all the glyphs on it
+    std::vector<GLuint> page_textures;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of single bytes aren't necessarily 4-aligned
+    for (AtlasPage page: pages) {
+        if (!(page.tex_begin <= page.tex_end && page.tex_end <= total
+              && page.tex_end - page.tex_begin == page.width * page.height)) {
+            throw std::runtime_error("atlas page has out-of-range tex begin/end");
         }
         
-        total = GLuint(data.size());
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, (GLsizei) page.width, (GLsizei) page.height, 0,
+                     GL_RED, GL_UNSIGNED_BYTE, data.data() + page.tex_begin);
+        // shaders see black with the coverage as alpha, same as the old RGBA textures
+        GLint swizzle[4] = {GL_ZERO, GL_ZERO, GL_ZERO, GL_RED};
+        glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        // took me waaay too long to figure out i needed the parameteri things
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // mipmaps keep small text from shimmering; render-glyphs pads glyphs so they don't bleed together
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        
+        GL_ERRORS();
+        
+        page_textures.push_back(texture);
     }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
     
-    std::vector<char> strings;
-    read_chunk(file, "str0", &strings);
+    ChunkView<char> strings = view_chunk<char>(&at, file.end(), "str0");
     
     {
-        struct TexIndexEntry {
+        struct AtlasIndexEntry {
             uint32_t name_begin, name_end;
-            uint32_t tex_begin, tex_end;
-            uint32_t width, height;
+            uint32_t page;
+            uint32_t x, y, width, height;
         };
-        static_assert(sizeof(TexIndexEntry) == 24, "TexIndexEntry should be packed");
+        static_assert(sizeof(AtlasIndexEntry) == 28, "AtlasIndexEntry should be packed");
         
-        std::vector<TexIndexEntry> index;
-        read_chunk(file, "idx1", &index);
+        ChunkView<AtlasIndexEntry> index = view_chunk<AtlasIndexEntry>(&at, file.end(), "idx2");
         
-        for (auto const &entry: index) {
+        for (AtlasIndexEntry entry: index) {
             if (!(entry.name_begin <= entry.name_end && entry.name_end <= strings.size())) {
                 throw std::runtime_error("index entry has out-of-range name begin/end");
             }
-            if (!(entry.tex_begin <= entry.tex_end && entry.tex_end <= total)) {
-                throw std::runtime_error("index entry has out-of-range tex start/count");
+            if (!(entry.page < pages.size()
+                  && entry.x + entry.width <= pages[entry.page].width
+                  && entry.y + entry.height <= pages[entry.page].height)) {
+                throw std::runtime_error("index entry has out-of-range atlas page/rectangle");
             }
-            std::string name(&strings[0] + entry.name_begin, &strings[0] + entry.name_end);
-            
-            GLuint texture;
-            glGenTextures(1, &texture);
-            glBindTexture(GL_TEXTURE_2D, texture);
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, (GLsizei) entry.width, (GLsizei) entry.height, 0,
-                         GL_RGBA, GL_UNSIGNED_BYTE, &colors[4 * entry.tex_begin]);
-            // took me waaay too long to figure out i needed the parameteri things
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-            textures[name] = texture;
-            glBindTexture(GL_TEXTURE_2D, 0);
+            std::string name(strings.data + entry.name_begin, strings.data + entry.name_end);
             
-            GL_ERRORS();
+            textures[name] = page_textures[entry.page];
+            if (tex_rects_) {
+                AtlasPage page = pages[entry.page];
+                (*tex_rects_)[name] = glm::vec4(
+                        float(entry.x) / float(page.width),
+                        float(entry.y) / float(page.height),
+                        float(entry.x + entry.width) / float(page.width),
+                        float(entry.y + entry.height) / float(page.height)
+                );
+            }
         }
     }
     
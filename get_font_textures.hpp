@@ -1,7 +1,30 @@
 #pragma once
 
+#include <cstdint>
 #include <map>
 #include <string>
+#include <glm/glm.hpp>
 #include "GL.hpp"
 
-std::map<std::string, GLuint> get_font_textures(std::string const &filename);
+// The first chunk ("txh0") of a .txtr says what's in the rest; render-glyphs writes it and get_font_textures checks it.
+// Bump TXTR_VERSION whenever the layout changes.
+constexpr uint32_t TXTR_VERSION = 3;
+
+struct TxtrHeader {
+    uint32_t version;
+    uint32_t channels; // bytes per pixel
+    uint32_t pixel_bytes; // size of the page pixels once decompressed
+    float distance_spread; // 0 for coverage, or how many texels the distance field reaches past the outline
+};
+static_assert(sizeof(TxtrHeader) == 16, "TxtrHeader should be packed");
+
+// Loads the atlas pages of a .txtr file (written by render-glyphs) as mipmapped textures.
+// Pages are single-channel (GL_R8) and swizzled to read as (0, 0, 0, coverage); throws on old or bad files.
+// Returns the page texture for each glyph name; glyphs share textures, so bind by page, not by glyph.
+// If tex_rects_ is given, it gets each glyph's spot in its page as (u_left, v_top, u_right, v_bottom),
+// the same texture coordinates the glyph's .pnct rectangle uses.
+// If distance_spread_ is given, it gets 0 for coverage textures, or for signed distance fields (render-glyphs --sdf),
+// how many texels the field reaches past the outline (alpha 0.5 is on the outline).
+std::map<std::string, GLuint> get_font_textures(std::string const &filename,
+                                                std::map<std::string, glm::vec4> *tex_rects_ = nullptr,
+                                                float *distance_spread_ = nullptr);
@@ -2,6 +2,7 @@
 
 #include <opusfile.h>
 
+#include <algorithm>
 #include <cassert>
 #include <memory>
 #include <stdexcept>
@@ -53,3 +54,37 @@ void load_opus(std::string const &filename, std::vector<float> *data_) {
     
     std::cout << " done." << std::endl;
 }
+
+OpusStream::OpusStream(std::string const &filename_) : filename(filename_) {
+    int err = 0;
+    op = op_open_file(filename.c_str(), &err);
+    if (err != 0) {
+        throw std::runtime_error("opusfile error " + std::to_string(err) + " opening \"" + filename + "\".");
+    }
+}
+
+OpusStream::~OpusStream() {
+    op_free(op);
+}
+
+uint32_t OpusStream::read(float *data, uint32_t count) {
+    count = std::min(count, MaxRead);
+    for (;;) {
+        int ret = op_read_float_stereo(op, pcm.data(), int(2 * count));
+        if (ret == OP_HOLE) continue; //(corrupt or missing data; skip it)
+        if (ret < 0) {
+            throw std::runtime_error("opusfile read error " + std::to_string(ret) + " reading \"" + filename + "\".");
+        }
+        for (uint32_t i = 0; i < uint32_t(ret); ++i) {
+            data[i] = (pcm[2 * i] + pcm[2 * i + 1]) * 0.5f; //downmix to mono by averaging
+        }
+        return uint32_t(ret);
+    }
+}
+
+void OpusStream::rewind() {
+    int ret = op_pcm_seek(op, 0);
+    if (ret != 0) {
+        throw std::runtime_error("opusfile error " + std::to_string(ret) + " seeking in \"" + filename + "\".");
+    }
+}
@@ -1,7 +1,35 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
 //Load an opus file as 48kHz floating-point mono; throws on error:
 void load_opus(std::string const &filename, std::vector<float> *data);
+
+struct OggOpusFile;
+
+//Decode an opus file a bit at a time (also as 48kHz floating-point mono), for streaming:
+struct OpusStream {
+    //Open the file; throws on error:
+    explicit OpusStream(std::string const &filename);
+    
+    ~OpusStream();
+    
+    OpusStream(OpusStream const &) = delete;
+    
+    OpusStream &operator=(OpusStream const &) = delete;
+    
+    //Decode up to 'count' samples into 'data'; returns the number decoded, which is 0 only at the end of the file.
+    // (reads at most MaxRead samples per call; throws on error)
+    uint32_t read(float *data, uint32_t count);
+    
+    //Go back to the first sample (for looping); throws on error:
+    void rewind();
+    
+    static constexpr uint32_t const MaxRead = 5760; //120ms -- the longest opus packet
+    
+    std::string filename;
+    OggOpusFile *op = nullptr;
+    std::vector<float> pcm = std::vector<float>(2 * MaxRead); //stereo, before downmixing
+};
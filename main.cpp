@@ -10,6 +10,9 @@
 //For sound init:
 #include "Sound.hpp"
 
+//For freeing the GL objects shared by all scenes:
+#include "Scene.hpp"
+
 //GL.hpp will include a non-namespace-polluting set of opengl prototypes:
 #include "GL.hpp"
 
@@ -187,6 +190,9 @@ int main(int argc, char **argv) {
             
             Mode::current->update(elapsed);
             if (!Mode::current) break;
+            
+            //let go of sounds that finished playing (even if the mode didn't start or change any):
+            Sound::update();
         }
         
         { //(3) call the current mode's "draw" function to produce output:
@@ -202,6 +208,8 @@ int main(int argc, char **argv) {
     //------------  teardown ------------
     Sound::shutdown();
     
+    Scene::release_gl();
+    
     SDL_GL_DeleteContext(context);
     context = nullptr;
     
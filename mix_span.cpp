@@ -0,0 +1,101 @@
+#include "mix_span.hpp"
+
+//SSE2 is part of x86-64 (and of 32-bit x86 builds that ask for it):
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIX_SSE2
+#include <emmintrin.h>
+//AVX2 isn't, so it gets compiled for just its kernel and only used if the CPU says it has it:
+// (GCC and clang only; MSVC builds use SSE2)
+#if defined(__GNUC__) || defined(__clang__)
+#define MIX_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+static void mix_scalar(float const *samples, uint32_t count, float *out,
+                       float left, float right, float left_step, float right_step) {
+    for (uint32_t i = 0; i < count; ++i) {
+        out[2 * i + 0] += left * samples[i];
+        out[2 * i + 1] += right * samples[i];
+        left += left_step;
+        right += right_step;
+    }
+}
+
+#ifdef MIX_SSE2
+static void mix_sse2(float const *samples, uint32_t count, float *out,
+                     float left, float right, float left_step, float right_step) {
+    //two samples per step; pan for both is (l0, r0, l1, r1):
+    __m128 pan = _mm_setr_ps(left, right, left + left_step, right + right_step);
+    __m128 step = _mm_setr_ps(2.0f * left_step, 2.0f * right_step, 2.0f * left_step, 2.0f * right_step);
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128 s = _mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast< __m128i const * >(samples + i))); //(s0, s1, 0, 0)
+        s = _mm_unpacklo_ps(s, s); //(s0, s0, s1, s1)
+        __m128 o = _mm_loadu_ps(out + 2 * i);
+        _mm_storeu_ps(out + 2 * i, _mm_add_ps(o, _mm_mul_ps(pan, s)));
+        pan = _mm_add_ps(pan, step);
+    }
+    //odd sample at the end:
+    float rest[4];
+    _mm_storeu_ps(rest, pan);
+    mix_scalar(samples + i, count - i, out + 2 * i, rest[0], rest[1], left_step, right_step);
+}
+#endif
+
+#ifdef MIX_AVX2
+__attribute__((target("avx2")))
+static void mix_avx2(float const *samples, uint32_t count, float *out,
+                     float left, float right, float left_step, float right_step) {
+    //four samples per step; pan for all of them is (l0, r0, l1, r1, l2, r2, l3, r3):
+    __m256 pan = _mm256_setr_ps(left, right,
+                                left + left_step, right + right_step,
+                                left + 2.0f * left_step, right + 2.0f * right_step,
+                                left + 3.0f * left_step, right + 3.0f * right_step);
+    __m256 step = _mm256_setr_ps(4.0f * left_step, 4.0f * right_step, 4.0f * left_step, 4.0f * right_step,
+                                 4.0f * left_step, 4.0f * right_step, 4.0f * left_step, 4.0f * right_step);
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 s = _mm_loadu_ps(samples + i); //(s0, s1, s2, s3)
+        //-> (s0, s0, s1, s1, s2, s2, s3, s3):
+        __m256 ss = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_unpacklo_ps(s, s)), _mm_unpackhi_ps(s, s), 1);
+        __m256 o = _mm256_loadu_ps(out + 2 * i);
+        _mm256_storeu_ps(out + 2 * i, _mm256_add_ps(o, _mm256_mul_ps(pan, ss)));
+        pan = _mm256_add_ps(pan, step);
+    }
+    //up to three samples at the end:
+    float rest[8];
+    _mm256_storeu_ps(rest, pan);
+    mix_scalar(samples + i, count - i, out + 2 * i, rest[0], rest[1], left_step, right_step);
+}
+#endif
+
+std::vector<MixKernel> const &mix_kernels() {
+    static std::vector<MixKernel> const kernels = []() {
+        std::vector<MixKernel> ret;
+#ifdef MIX_AVX2
+        if (__builtin_cpu_supports("avx2")) ret.emplace_back(MixKernel{"avx2", mix_avx2});
+#endif
+#ifdef MIX_SSE2
+        ret.emplace_back(MixKernel{"sse2", mix_sse2});
+#endif
+        ret.emplace_back(MixKernel{"scalar", mix_scalar});
+        return ret;
+    }();
+    return kernels;
+}
+
+//a plain file-scope pointer, so calling through it never touches a function-local static's guard:
+static void (*selected_mix)(float const *samples, uint32_t count, float *out,
+                            float left, float right, float left_step, float right_step) = mix_scalar;
+
+MixKernel const &select_mix_kernel() {
+    MixKernel const &kernel = mix_kernels().front();
+    selected_mix = kernel.mix;
+    return kernel;
+}
+
+void mix_span(float const *samples, uint32_t count, float *out,
+              float left, float right, float left_step, float right_step) {
+    selected_mix(samples, count, out, left, right, left_step, right_step);
+}
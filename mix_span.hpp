@@ -0,0 +1,33 @@
+#pragma once
+
+/*
+ * Mixing kernels used by Sound's audio callback.
+ *
+ * Each kernel adds 'count' mono samples into 'out' (interleaved left, right), weighted by a pan that starts
+ * at (left, right) and goes up by (left_step, right_step) after every sample:
+ *   out[2i+0] += (left + i * left_step) * samples[i]
+ *   out[2i+1] += (right + i * right_step) * samples[i]
+ * i.e., the same thing the one-sample-at-a-time loop in mix_audio used to do between loop points.
+ *
+ * The SIMD kernels keep the pan for several samples in a register and step it there.
+ */
+
+#include <cstdint>
+#include <vector>
+
+struct MixKernel {
+    char const *name;
+    void (*mix)(float const *samples, uint32_t count, float *out,
+                float left, float right, float left_step, float right_step);
+};
+
+//kernels this machine can run, best first (always ends with "scalar"):
+std::vector<MixKernel> const &mix_kernels();
+
+//make mix_span use the best kernel in mix_kernels(), returning it:
+// (call before any mixing starts -- e.g., from Sound::init -- so the audio thread never has to pick one)
+MixKernel const &select_mix_kernel();
+
+//mix with the kernel select_mix_kernel() picked (the scalar kernel until it's called):
+void mix_span(float const *samples, uint32_t count, float *out,
+              float left, float right, float left_step, float right_step);
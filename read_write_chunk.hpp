@@ -4,6 +4,7 @@
 #include <vector>
 #include <stdexcept>
 #include <cassert>
+#include <cstring>
 
 //helper function that reads an array of structures preceded by a simple header:
 //Expected format:
@@ -41,6 +42,83 @@ void read_chunk(std::istream &from, std::string const &magic, std::vector<T> *to
 }
 
 
+//read_chunk's counterpart for files that are already in memory (e.g., a MappedFile):
+// rather than copying the chunk, returns a view of it in place.
+// (chunk data need not be aligned for T, so elements are copied out one at a time as they are accessed)
+template<typename T>
+struct ChunkView {
+    char const *data = nullptr;
+    size_t count = 0;
+    
+    size_t size() const { return count; }
+    
+    bool empty() const { return count == 0; }
+    
+    T operator[](size_t i) const {
+        assert(i < count);
+        T t;
+        std::memcpy(reinterpret_cast< char * >(&t), data + i * sizeof(T), sizeof(T));
+        return t;
+    }
+    
+    struct iterator {
+        char const *at;
+        
+        T operator*() const {
+            T t;
+            std::memcpy(reinterpret_cast< char * >(&t), at, sizeof(T));
+            return t;
+        }
+        
+        iterator &operator++() {
+            at += sizeof(T);
+            return *this;
+        }
+        
+        bool operator!=(iterator const &other) const { return at != other.at; }
+    };
+    
+    iterator begin() const { return iterator{data}; }
+    
+    iterator end() const { return iterator{data + count * sizeof(T)}; }
+};
+
+//reads a chunk header at *at_ (which must be before end), returns a view of its data, and advances *at_ past it:
+template<typename T>
+ChunkView<T> view_chunk(char const **at_, char const *end, std::string const &magic) {
+    assert(at_);
+    auto &at = *at_;
+    
+    struct ChunkHeader {
+        char magic[4] = {'\0', '\0', '\0', '\0'};
+        uint32_t size = 0;
+    };
+    static_assert(sizeof(ChunkHeader) == 8, "header is packed");
+    
+    ChunkHeader header;
+    if (size_t(end - at) < sizeof(header)) {
+        throw std::runtime_error("Failed to read chunk header");
+    }
+    std::memcpy(reinterpret_cast< char * >(&header), at, sizeof(header));
+    at += sizeof(header);
+    if (std::string(header.magic, 4) != magic) {
+        throw std::runtime_error("Unexpected magic number in chunk");
+    }
+    
+    if (header.size % sizeof(T) != 0) {
+        throw std::runtime_error("Size of chunk not divisible by element size");
+    }
+    
+    if (size_t(end - at) < header.size) {
+        throw std::runtime_error("Failed to read chunk data.");
+    }
+    ChunkView<T> view;
+    view.data = at;
+    view.count = header.size / sizeof(T);
+    at += header.size;
+    return view;
+}
+
 //helper function to write a chunk of data in the same format as read_chunk:
 template<typename T>
 void write_chunk(std::string const &magic, std::vector<T> const &from, std::ostream *to_) {
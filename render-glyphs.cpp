@@ -2,40 +2,391 @@
  * This file takes a .tff file, renders its glyphs using FreeType, and writes them to assets the program
  * can use. One output is a .pnct file that can be converted into a MeshBuffer, just like Blender exports.
  * There is one rectangle (two triangles really) for each glyph. The other file is a .txtr file, which is
- * a chunk-based format very similar to MeshBuffer, and is processed to produce a texture for each glyph.
+ * a chunk-based format very similar to MeshBuffer. It holds the glyph bitmaps packed into a few atlas pages
+ * (one byte of coverage per pixel, zlib-compressed), and each rectangle's texture coordinates point at its
+ * glyph's spot in the atlas.
+ *
+ * Glyphs are rasterized on several threads (each with its own FT_Face), but put together in glyph order, so the
+ * files come out byte for byte the same however many threads there are. Given a text corpus (e.g. the game's word
+ * lists), only the glyphs needed to shape it are kept. Run with no arguments for Inknut Antiqua; see usage() below.
  */
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
+#include <hb.h>
+#include <hb-ft.h>
+#include <zlib.h>
 
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
 #include <glm/glm.hpp>
 
 #include "data_path.hpp"
+#include "get_font_textures.hpp"
 #include "read_write_chunk.hpp"
 #include "util.hpp"
 
-int main(int argc, char **argv) {
-    FT_Library ft_library;
-    FT_Face face;
+// Atlas pages are square, and glyphs are kept this many pixels apart (and from the edges)
+constexpr uint32_t ATLAS_SIZE = 2048;
+constexpr uint32_t ATLAS_PADDING = 4;
+
+// With --sdf, glyphs are stored as signed distance fields instead of coverage: each texel holds the distance to the
+// outline (0.5 is on it, more is inside), which stays sharp under magnification even at much lower resolution.
+// Distances are measured on the full PIXEL_COUNT rendering, then stored at 1/SDF_DOWNSAMPLE of that resolution,
+// out to SDF_SPREAD texels on either side of the outline.
+constexpr uint32_t SDF_DOWNSAMPLE = 4;
+constexpr uint32_t SDF_SPREAD = 4;
+
+// a glyph's bitmap, row by row, top-down
+struct GlyphBitmap {
+    std::vector<uint8_t> pixels;
+    uint32_t width = 0, height = 0;
+    uint32_t vertex_begin = 0;
+};
+
+// Squared distance transform of one row or column (Felzenszwalb and Huttenlocher, "Distance Transforms of Sampled
+// Functions"): d[i] = min over j of (i - j)^2 + f[j], in linear time. f is strided so this works on columns too.
+static void distance_transform_1d(float *f, size_t count, size_t stride,
+                                  std::vector<float> *d_, std::vector<uint32_t> *v_, std::vector<float> *z_) {
+    auto &d = *d_;
+    auto &v = *v_; // locations of parabolas in the lower envelope
+    auto &z = *z_; // boundaries between them
+    d.resize(count);
+    v.resize(count);
+    z.resize(count + 1);
     
-    if (FT_Init_FreeType(&ft_library)) {
-        assert(false && "Problem initializing FreeType");
+    size_t k = 0;
+    v[0] = 0;
+    z[0] = -std::numeric_limits<float>::infinity();
+    z[1] = std::numeric_limits<float>::infinity();
+    for (size_t q = 1; q < count; q++) {
+        // where the parabola from q crosses the one from v[k]; drop parabolas it hides completely
+        auto intersect = [&](size_t p) {
+            return ((f[q * stride] + float(q * q)) - (f[p * stride] + float(p * p)))
+                   / (2.0f * float(q) - 2.0f * float(p));
+        };
+        float s = intersect(v[k]);
+        while (s <= z[k]) {
+            k--;
+            s = intersect(v[k]);
+        }
+        k++;
+        v[k] = (uint32_t) q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<float>::infinity();
     }
-    if (FT_New_Face(ft_library,
-                    data_path("fonts/Inknut_Antiqua/InknutAntiqua-Regular.ttf").c_str(),
-                    0, &face)) {
-        assert(false && "Problem initializing font");
+    k = 0;
+    for (size_t q = 0; q < count; q++) {
+        while (z[k + 1] < float(q)) k++;
+        float dq = float(q) - float(v[k]);
+        d[q] = dq * dq + f[v[k] * stride];
+    }
+    for (size_t q = 0; q < count; q++) {
+        f[q * stride] = d[q];
+    }
+}
+
+// Squared distance from every pixel to the nearest pixel where 'inside' is true, in place.
+static void distance_transform_2d(std::vector<float> *grid_, size_t width, size_t height) {
+    auto &grid = *grid_;
+    std::vector<float> d;
+    std::vector<uint32_t> v;
+    std::vector<float> z;
+    for (size_t x = 0; x < width; x++) {
+        distance_transform_1d(&grid[x], height, width, &d, &v, &z);
+    }
+    for (size_t y = 0; y < height; y++) {
+        distance_transform_1d(&grid[y * width], width, 1, &d, &v, &z);
+    }
+}
+
+// Turns a coverage bitmap into a signed distance field SDF_DOWNSAMPLE times smaller, with SDF_SPREAD texels of
+// padding all around (so the field has room to fall off outside the outline).
+static GlyphBitmap make_distance_field(GlyphBitmap const &coverage) {
+    size_t pad = SDF_SPREAD * SDF_DOWNSAMPLE;
+    GlyphBitmap field;
+    field.width = uint32_t((coverage.width + 2 * pad + SDF_DOWNSAMPLE - 1) / SDF_DOWNSAMPLE);
+    field.height = uint32_t((coverage.height + 2 * pad + SDF_DOWNSAMPLE - 1) / SDF_DOWNSAMPLE);
+    size_t width = field.width * SDF_DOWNSAMPLE;
+    size_t height = field.height * SDF_DOWNSAMPLE;
+    
+    // squared distance to the nearest inside pixel, and to the nearest outside pixel:
+    float const far = float(width * width + height * height);
+    std::vector<float> to_inside(width * height, far);
+    std::vector<float> to_outside(width * height, 0.0f);
+    for (size_t y = 0; y < coverage.height; y++) {
+        for (size_t x = 0; x < coverage.width; x++) {
+            if (coverage.pixels[y * coverage.width + x] >= 128) {
+                size_t i = (y + pad) * width + (x + pad);
+                to_inside[i] = 0.0f;
+                to_outside[i] = far;
+            }
+        }
+    }
+    distance_transform_2d(&to_inside, width, height);
+    distance_transform_2d(&to_outside, width, height);
+    
+    // average each block of pixels down to one texel, mapping [-SDF_SPREAD, SDF_SPREAD] texels to [0, 255]:
+    field.pixels.resize(field.width * field.height);
+    for (size_t ty = 0; ty < field.height; ty++) {
+        for (size_t tx = 0; tx < field.width; tx++) {
+            float sum = 0.0f;
+            for (size_t y = ty * SDF_DOWNSAMPLE; y < (ty + 1) * SDF_DOWNSAMPLE; y++) {
+                for (size_t x = tx * SDF_DOWNSAMPLE; x < (tx + 1) * SDF_DOWNSAMPLE; x++) {
+                    size_t i = y * width + x;
+                    // half a pixel each way puts the zero crossing between inside and outside pixels
+                    sum += (to_inside[i] == 0.0f) ? std::sqrt(to_outside[i]) - 0.5f : 0.5f - std::sqrt(to_inside[i]);
+                }
+            }
+            float distance = sum / float(SDF_DOWNSAMPLE * SDF_DOWNSAMPLE) / float(SDF_DOWNSAMPLE);
+            float value = 0.5f + 0.5f * distance / float(SDF_SPREAD);
+            field.pixels[ty * field.width + tx] = (uint8_t) std::lround(255.0f * std::min(1.0f, std::max(0.0f, value)));
+        }
+    }
+    return field;
+}
+
+// Everything rendering one glyph finds out. Workers fill these in (in whatever order they get to them), then the main
+// thread puts them together in glyph order, so the output doesn't depend on how many threads there are.
+struct RenderedGlyph {
+    FT_UInt glyph_index = 0;
+    bool named = false; // unnamed glyphs are left out of the output
+    std::string name;
+    bool loaded = false;
+    GlyphBitmap bitmap;
+    // where the bitmap's corners go, in pixels relative to the pen position
+    FT_Int top = 0, left = 0, bottom = 0, right = 0;
+};
+
+static void render_glyph(FT_Face face, bool sdf, RenderedGlyph *rendered_) {
+    auto &rendered = *rendered_;
+    { // Find the name
+        /*
+         * There's probably not an official limit anywhere since anyone can make a font, but
+         * - https://github.com/adobe-type-tools/agl-specification
+         * - https://learn.microsoft.com/en-us/typography/opentype/spec/post
+         * - http://adobe-type-tools.github.io/afdko/OpenTypeFeatureFileSpecification.html#2fi-glyph-name
+         * agree that it's maximum 63 characters. So, 64 for the 63 and a null terminator.
+         */
+        char buf[64];
+        /*
+         * From the FreeType documentation https://freetype.org/freetype2/docs/reference/ft2-information_retrieval.html#ft_get_glyph_name:
+         *
+         * This function has limited capabilities if the config macro FT_CONFIG_OPTION_POSTSCRIPT_NAMES is not defined in ftoption.h:
+         * It then works only for fonts that actually embed glyph names (which many recent OpenType fonts do not).
+         *
+         * This flag is defined on the MacOS distribution of nest-libs. It should be checked on other versions.
+         */
+        if (FT_Get_Glyph_Name(face, rendered.glyph_index, buf, 64)) {
+            return;
+        }
+        rendered.named = true;
+        rendered.name = buf;
+    }
+    
+    /*
+     * FT_LOAD_RENDER ensures the bitmap is filled. The default is using FT_RENDER_MODE_NORMAL,
+     * which means every byte is a pixel's alpha value.
+     *
+     * There are other ways to do the drawing using a callback system, but as far as I can tell that only works
+     * on outlines. This approach relies on FreeType's shipped renderer and should work for all fonts.
+     */
+    rendered.loaded = FT_Load_Glyph(face, rendered.glyph_index, FT_LOAD_RENDER) == 0;
+    if (!rendered.loaded) return; // (an empty quad)
+    
+    GlyphBitmap &glyph_bitmap = rendered.bitmap;
+    rendered.top = face->glyph->bitmap_top;
+    rendered.left = face->glyph->bitmap_left;
+    
+    FT_Bitmap &bitmap = face->glyph->bitmap;
+    glyph_bitmap.height = bitmap.rows;
+    glyph_bitmap.width = bitmap.width;
+    
+    glyph_bitmap.pixels.reserve(bitmap.rows * bitmap.width);
+    unsigned int r = 0;
+    // filled in row by row, top-down
+    for (uint8_t *row = bitmap.buffer; r < bitmap.rows; row = &row[bitmap.pitch], r++) {
+        glyph_bitmap.pixels.insert(glyph_bitmap.pixels.end(), row, row + bitmap.width);
+    }
+    
+    rendered.bottom = rendered.top - (FT_Int) glyph_bitmap.height;
+    rendered.right = rendered.left + (FT_Int) glyph_bitmap.width;
+    
+    if (sdf && glyph_bitmap.width != 0 && glyph_bitmap.height != 0) {
+        // The field reaches past the outline, so the quad grows by the spread on every side
+        // (and a little more so the size divides evenly into texels).
+        FT_Int pad = (FT_Int) (SDF_SPREAD * SDF_DOWNSAMPLE);
+        glyph_bitmap = make_distance_field(glyph_bitmap);
+        rendered.top += pad;
+        rendered.left -= pad;
+        rendered.bottom = rendered.top - (FT_Int) (glyph_bitmap.height * SDF_DOWNSAMPLE);
+        rendered.right = rendered.left + (FT_Int) (glyph_bitmap.width * SDF_DOWNSAMPLE);
+    }
+}
+
+// Opens the font at the given size (each thread needs its own face, since FreeType faces aren't thread safe).
+static void open_face(std::string const &font_path, uint32_t size, FT_Library *library_, FT_Face *face_) {
+    if (FT_Init_FreeType(library_)) {
+        throw std::runtime_error("Problem initializing FreeType");
+    }
+    if (FT_New_Face(*library_, font_path.c_str(), 0, face_)) {
+        throw std::runtime_error("Problem opening font '" + font_path + "'");
     }
     // the unit is 1/64 pixel, so this is the right count of pixels.
     // 0 for char_height assumes the same as char_width.
-    if (FT_Set_Char_Size(face, PIXEL_COUNT * 64, 0, 0, 0)) {
-        assert(false && "Problem setting character size");
+    if (FT_Set_Char_Size(*face_, (FT_F26Dot6) size * 64, 0, 0, 0)) {
+        throw std::runtime_error("Problem setting character size");
+    }
+}
+
+static void close_face(FT_Library library, FT_Face face) {
+    if (FT_Done_Face(face)) {
+        assert(false && "Problem destroying face");
+    }
+    if (FT_Done_FreeType(library)) {
+        assert(false && "Problem destroying library");
+    }
+}
+
+// Glyphs HarfBuzz uses to shape each line of the corpus files (so ligatures and contextual forms come along too):
+static std::set<FT_UInt> corpus_glyphs(FT_Face face, std::vector<std::string> const &corpus_paths) {
+    std::set<FT_UInt> glyphs;
+    glyphs.insert(0); // .notdef, for anything missing
+    hb_font_t *font = hb_ft_font_create_referenced(face);
+    hb_buffer_t *buffer = hb_buffer_create();
+    for (std::string const &path: corpus_paths) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Problem opening corpus '" + path + "'");
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            hb_buffer_clear_contents(buffer);
+            hb_buffer_add_utf8(buffer, line.c_str(), (int) line.size(), 0, -1);
+            hb_buffer_guess_segment_properties(buffer);
+            hb_shape(font, buffer, nullptr, 0);
+            unsigned int len = hb_buffer_get_length(buffer);
+            hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buffer, nullptr);
+            for (unsigned int i = 0; i < len; i++) {
+                glyphs.insert(info[i].codepoint); // after shaping, the codepoint is the glyph index
+            }
+        }
+    }
+    hb_buffer_destroy(buffer);
+    hb_font_destroy(font);
+    return glyphs;
+}
+
+static void usage() {
+    std::cerr << "usage: render-glyphs [--sdf] [--size PIXELS] [--corpus TEXT_FILE]... [--threads N]\n"
+                 "                     [--out OUTPUT_BASE] [FONT.ttf]\n"
+                 "  writes OUTPUT_BASE.pnct and OUTPUT_BASE.txtr (default: dist/InknutAntiqua, from Inknut Antiqua)\n"
+                 "  --size     pixels per em to render at (default " << PIXEL_COUNT << "); glyph quads keep the same\n"
+                 "             size in the scene no matter what\n"
+                 "  --corpus   only keep glyphs needed to shape the lines of this file (may be given more than once)\n"
+                 "  --threads  how many threads rasterize glyphs (default: one per core); the output is the same\n";
+}
+
+int main(int argc, char **argv) {
+    bool sdf = false;
+    uint32_t size = PIXEL_COUNT;
+    std::vector<std::string> corpus_paths;
+    uint32_t thread_count = std::max(1U, std::thread::hardware_concurrency());
+    std::string font_path = data_path("fonts/Inknut_Antiqua/InknutAntiqua-Regular.ttf");
+    std::string out_base = data_path("dist/InknutAntiqua");
+    try {
+        bool have_font = false;
+        for (int a = 1; a < argc; a++) {
+            std::string arg = argv[a];
+            // options that take a value:
+            auto value = [&]() -> std::string {
+                if (a + 1 >= argc) throw std::runtime_error(arg + " needs a value");
+                return argv[++a];
+            };
+            if (arg == "--sdf") {
+                sdf = true;
+            } else if (arg == "--size") {
+                size = (uint32_t) std::stoul(value());
+            } else if (arg == "--corpus") {
+                corpus_paths.emplace_back(value());
+            } else if (arg == "--threads") {
+                thread_count = (uint32_t) std::stoul(value());
+            } else if (arg == "--out") {
+                out_base = value();
+            } else if (!have_font && !arg.empty() && arg[0] != '-') {
+                font_path = arg;
+                have_font = true;
+            } else {
+                throw std::runtime_error("unexpected argument '" + arg + "'");
+            }
+        }
+        if (size == 0 || thread_count == 0) throw std::runtime_error("--size and --threads must be at least 1");
+    } catch (std::exception const &e) {
+        std::cerr << e.what() << "\n";
+        usage();
+        return 1;
     }
+    // quads are measured in ems (the same units the game's text layout uses), whatever size they're rendered at
+    float const pixel_scale = 1.0f / (float) size;
     
-    std::cout << "Inknut Antiqua provides " << face->num_glyphs << " glyphs.\n";
+    FT_Library ft_library;
+    FT_Face face;
+    open_face(font_path, size, &ft_library, &face);
+    
+    std::cout << face->family_name << " provides " << face->num_glyphs << " glyphs.\n";
+    
+    // Which glyphs to render, in glyph index order:
+    std::vector<RenderedGlyph> rendered;
+    if (corpus_paths.empty()) {
+        rendered.resize((size_t) face->num_glyphs);
+        for (FT_Long glyph_index = 0; glyph_index < face->num_glyphs; glyph_index++) {
+            rendered[(size_t) glyph_index].glyph_index = (FT_UInt) glyph_index;
+        }
+    } else {
+        for (FT_UInt glyph_index: corpus_glyphs(face, corpus_paths)) {
+            rendered.emplace_back();
+            rendered.back().glyph_index = glyph_index;
+        }
+        std::cout << "The corpus needs " << rendered.size() << " of them.\n";
+    }
+    
+    { // Render in parallel; each thread takes the next glyph nobody has started yet
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        std::vector<std::string> errors(thread_count);
+        for (uint32_t t = 0; t < thread_count; t++) {
+            threads.emplace_back([&, t]() {
+                try {
+                    FT_Library thread_library;
+                    FT_Face thread_face;
+                    open_face(font_path, size, &thread_library, &thread_face);
+                    for (size_t i = next++; i < rendered.size(); i = next++) {
+                        render_glyph(thread_face, sdf, &rendered[i]);
+                    }
+                    close_face(thread_library, thread_face);
+                } catch (std::exception const &e) {
+                    errors[t] = e.what();
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        for (auto const &error: errors) {
+            if (!error.empty()) throw std::runtime_error(error);
+        }
+    }
     
     /*
      * This next part realizes the glyph in .pnct format.
@@ -63,151 +414,213 @@ int main(int argc, char **argv) {
     };
     static_assert(sizeof(IndexEntry) == 16, "IndexEntry should be packed");
     
-    struct TexIndexEntry {
-        uint32_t name_begin, name_end;
+    // Glyph bitmaps are packed into a few big atlas pages rather than getting a texture each,
+    // so that text can be drawn without switching textures between glyphs.
+    struct AtlasPage {
         uint32_t tex_begin, tex_end;
         uint32_t width, height;
     };
-    static_assert(sizeof(TexIndexEntry) == 24, "TexIndexEntry should be packed");
+    static_assert(sizeof(AtlasPage) == 16, "AtlasPage should be packed");
+    
+    struct AtlasIndexEntry {
+        uint32_t name_begin, name_end;
+        uint32_t page;
+        uint32_t x, y, width, height; // in pixels, from the top left of the page
+    };
+    static_assert(sizeof(AtlasIndexEntry) == 28, "AtlasIndexEntry should be packed");
     
+    // Bitmaps are kept around until every glyph is rendered, since packing works better knowing all the sizes
     std::vector<Vertex> vertices;
-    std::vector<uint8_t> texture_colors;
     std::vector<char> strings;
     std::vector<IndexEntry> vertex_indices;
-    std::vector<TexIndexEntry> texture_indices;
+    std::vector<AtlasIndexEntry> atlas_indices;
+    std::vector<GlyphBitmap> bitmaps;
     
     size_t glyph_count = 0;
-    // Loop through all the glyphs and render them in .pnct and .txtr formats.
-    // I couldn't find what glyph indices are officially valid, but it seems like this works for the font I'm using.
-    for (FT_Long glyph_index = 0; glyph_index < face->num_glyphs; glyph_index++) {
-        IndexEntry index_entry{};
-        TexIndexEntry tex_index_entry{};
-        { // Find the name and add it
-            /*
-             * There's probably not an official limit anywhere since anyone can make a font, but
-             * - https://github.com/adobe-type-tools/agl-specification
-             * - https://learn.microsoft.com/en-us/typography/opentype/spec/post
-             * - http://adobe-type-tools.github.io/afdko/OpenTypeFeatureFileSpecification.html#2fi-glyph-name
-             * agree that it's maximum 63 characters. So, 64 for the 63 and a null terminator.
-             */
-            char buf[64];
-            /*
-             * From the FreeType documentation https://freetype.org/freetype2/docs/reference/ft2-information_retrieval.html#ft_get_glyph_name:
-             *
-             * This function has limited capabilities if the config macro FT_CONFIG_OPTION_POSTSCRIPT_NAMES is not defined in ftoption.h:
-             * It then works only for fonts that actually embed glyph names (which many recent OpenType fonts do not).
-             *
-             * This flag is defined on the MacOS distribution of nest-libs. It should be checked on other versions.
-             */
-            if (FT_Get_Glyph_Name(face, glyph_index, buf, 64)) {
-                std::cerr << "Problem getting glyph name for index_entry " << glyph_index << "\n";
-                continue;
-            }
-            std::string name(buf);
-            // std::cout << "Found name \"" << name << "\" for index_entry " << glyph_index << "\n";
-            
-            index_entry.name_begin = (uint32_t) strings.size();
-            tex_index_entry.name_begin = (uint32_t) strings.size();
-            strings.insert(strings.end(), name.begin(), name.end());
-            index_entry.name_end = (uint32_t) strings.size();
-            tex_index_entry.name_end = (uint32_t) strings.size();
+    // Put the rendered glyphs together in .pnct and .txtr formats, in glyph order (so the output never changes)
+    for (RenderedGlyph &glyph: rendered) {
+        if (!glyph.named) {
+            std::cerr << "Problem getting glyph name for index_entry " << glyph.glyph_index << "\n";
+            continue;
         }
-        
-        /*
-         * FT_LOAD_RENDER ensures the bitmap is filled. The default is using FT_RENDER_MODE_NORMAL,
-         * which means every byte is a pixel's alpha value.
-         *
-         * There are other ways to do the drawing using a callback system, but as far as I can tell that only works
-         * on outlines. This approach relies on FreeType's shipped renderer and should work for all fonts.
-         */
-        if (FT_Load_Glyph(face, glyph_index, FT_LOAD_RENDER)) {
-            std::cerr << "Warning: problem getting glyph with index_entry " << glyph_index << " (out of "
+        if (!glyph.loaded) {
+            std::cerr << "Warning: problem getting glyph with index_entry " << glyph.glyph_index << " (out of "
                       << face->num_glyphs
                       << "glyphs)\n";
         } else {
             glyph_count++;
         }
         
+        IndexEntry index_entry{};
+        AtlasIndexEntry atlas_index_entry{};
+        { // Add the name
+            index_entry.name_begin = (uint32_t) strings.size();
+            atlas_index_entry.name_begin = (uint32_t) strings.size();
+            strings.insert(strings.end(), glyph.name.begin(), glyph.name.end());
+            index_entry.name_end = (uint32_t) strings.size();
+            atlas_index_entry.name_end = (uint32_t) strings.size();
+        }
+        
+        GlyphBitmap &glyph_bitmap = glyph.bitmap;
+        FT_Int top = glyph.top, left = glyph.left, bottom = glyph.bottom, right = glyph.right;
+        
         { // Make the rectangle
             index_entry.vertex_begin = (uint32_t) vertices.size();
+            glyph_bitmap.vertex_begin = index_entry.vertex_begin;
             // all of these are in pixels
-            FT_Int top = face->glyph->bitmap_top;
-            FT_Int left = face->glyph->bitmap_left;
-            FT_Int bottom = top - (FT_Int) face->glyph->bitmap.rows;
-            FT_Int right = left + (FT_Int) face->glyph->bitmap.width;
             
             // It's a little weird that I'm going top then bottom but it helps with the pixel loop later
+            // The texture coordinates get moved to the glyph's spot in the atlas once it's packed
             
             // draw the first triangle
-            vertices.emplace_back(glm::vec3((float) left * PIXEL_SCALE,
-                                            (float) top * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) left * pixel_scale,
+                                            (float) top * pixel_scale,
                                             0),
                                   glm::vec2(0.0, 0.0));
-            vertices.emplace_back(glm::vec3((float) right * PIXEL_SCALE,
-                                            (float) top * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) right * pixel_scale,
+                                            (float) top * pixel_scale,
                                             0),
                                   glm::vec2(1.0, 0.0));
-            vertices.emplace_back(glm::vec3((float) right * PIXEL_SCALE,
-                                            (float) bottom * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) right * pixel_scale,
+                                            (float) bottom * pixel_scale,
                                             0),
                                   glm::vec2(1.0, 1.0));
-            vertices.emplace_back(glm::vec3((float) left * PIXEL_SCALE,
-                                            (float) top * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) left * pixel_scale,
+                                            (float) top * pixel_scale,
                                             0),
                                   glm::vec2(0.0, 0.0));
-            vertices.emplace_back(glm::vec3((float) right * PIXEL_SCALE,
-                                            (float) bottom * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) right * pixel_scale,
+                                            (float) bottom * pixel_scale,
                                             0),
                                   glm::vec2(1.0, 1.0));
-            vertices.emplace_back(glm::vec3((float) left * PIXEL_SCALE,
-                                            (float) bottom * PIXEL_SCALE,
+            vertices.emplace_back(glm::vec3((float) left * pixel_scale,
+                                            (float) bottom * pixel_scale,
                                             0),
                                   glm::vec2(0.0, 1.0));
             index_entry.vertex_end = (uint32_t) vertices.size();
         }
         
-        { // Fill the texture
-            FT_Bitmap &bitmap = face->glyph->bitmap;
-            tex_index_entry.height = bitmap.rows;
-            tex_index_entry.width = bitmap.width;
+        bitmaps.push_back(std::move(glyph_bitmap));
+        
+        atlas_indices.push_back(atlas_index_entry);
+        vertex_indices.push_back(index_entry);
+    }
+    
+    std::vector<AtlasPage> pages;
+    std::vector<uint8_t> texture_colors;
+    { // Pack the bitmaps into atlas pages
+        /*
+         * This is a simple "shelf" packer: glyphs go left to right along a shelf, and a new shelf starts
+         * below the tallest glyph when one doesn't fit. Going tallest first keeps the wasted space above
+         * shorter glyphs small. A glyph that doesn't fit on a page at all starts a new page.
+         *
+         * The padding keeps neighbors from bleeding into each other once the loader builds mipmaps.
+         */
+        std::vector<uint32_t> order(bitmaps.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return bitmaps[a].height > bitmaps[b].height;
+        });
+        
+        uint32_t shelf_x = ATLAS_PADDING, shelf_y = ATLAS_PADDING, shelf_height = 0;
+        for (uint32_t i: order) {
+            GlyphBitmap const &bitmap = bitmaps[i];
+            AtlasIndexEntry &entry = atlas_indices[i];
+            if (bitmap.width + 2 * ATLAS_PADDING > ATLAS_SIZE || bitmap.height + 2 * ATLAS_PADDING > ATLAS_SIZE) {
+                throw std::runtime_error("glyph " + std::to_string(i) + " is too big for an atlas page");
+            }
             
-            tex_index_entry.tex_begin = (uint32_t) texture_colors.size();
-            unsigned int r = 0;
-            // filled in row by row, top-down
-            for (uint8_t *row = bitmap.buffer; r < bitmap.rows; row = &row[bitmap.pitch], r++) {
-                unsigned int c = 0;
-                for (uint8_t *col = row; c < bitmap.width; col++, c++) {
-                    texture_colors.push_back(*col);
-                }
+            if (shelf_x + bitmap.width + ATLAS_PADDING > ATLAS_SIZE) { // next shelf
+                shelf_x = ATLAS_PADDING;
+                shelf_y += shelf_height + ATLAS_PADDING;
+                shelf_height = 0;
             }
+            if (pages.empty() || shelf_y + bitmap.height + ATLAS_PADDING > ATLAS_SIZE) { // next page
+                pages.push_back(AtlasPage{0, 0, ATLAS_SIZE, ATLAS_SIZE});
+                shelf_x = ATLAS_PADDING;
+                shelf_y = ATLAS_PADDING;
+                shelf_height = 0;
+            }
+            
+            entry.page = (uint32_t) pages.size() - 1;
+            entry.x = shelf_x;
+            entry.y = shelf_y;
+            entry.width = bitmap.width;
+            entry.height = bitmap.height;
             
-            tex_index_entry.tex_end = (uint32_t) texture_colors.size();
+            shelf_x += bitmap.width + ATLAS_PADDING;
+            shelf_height = std::max(shelf_height, bitmap.height);
+            // pages only need to be as tall as they're filled (this matters for small glyphs, e.g. with --sdf)
+            pages.back().height = shelf_y + shelf_height + ATLAS_PADDING;
         }
         
-        texture_indices.push_back(tex_index_entry);
-        vertex_indices.push_back(index_entry);
+        // Pages are stored one after another, each row by row, top-down like the bitmaps
+        for (auto &page: pages) {
+            page.tex_begin = (uint32_t) texture_colors.size();
+            texture_colors.resize(texture_colors.size() + page.width * page.height, 0);
+            page.tex_end = (uint32_t) texture_colors.size();
+        }
+        
+        for (uint32_t i = 0; i < bitmaps.size(); i++) {
+            GlyphBitmap const &bitmap = bitmaps[i];
+            AtlasIndexEntry const &entry = atlas_indices[i];
+            AtlasPage const &page = pages[entry.page];
+            for (uint32_t r = 0; r < bitmap.height; r++) {
+                std::copy(bitmap.pixels.begin() + r * bitmap.width,
+                          bitmap.pixels.begin() + (r + 1) * bitmap.width,
+                          texture_colors.begin() + page.tex_begin + (entry.y + r) * page.width + entry.x);
+            }
+            
+            // same corner order as the rectangle above: TL, TR, BR, TL, BR, BL
+            float u_left = (float) entry.x / (float) page.width;
+            float u_right = (float) (entry.x + entry.width) / (float) page.width;
+            float v_top = (float) entry.y / (float) page.height;
+            float v_bottom = (float) (entry.y + entry.height) / (float) page.height;
+            Vertex *quad = &vertices[bitmap.vertex_begin];
+            quad[0].TexCoord = glm::vec2(u_left, v_top);
+            quad[1].TexCoord = glm::vec2(u_right, v_top);
+            quad[2].TexCoord = glm::vec2(u_right, v_bottom);
+            quad[3].TexCoord = glm::vec2(u_left, v_top);
+            quad[4].TexCoord = glm::vec2(u_right, v_bottom);
+            quad[5].TexCoord = glm::vec2(u_left, v_bottom);
+        }
     }
     
     { // write rectangles to .pnct file
-        std::ofstream out(data_path("dist/InknutAntiqua.pnct"), std::ios::binary);
+        std::ofstream out(out_base + ".pnct", std::ios::binary);
         write_chunk("pnct", vertices, &out);
         write_chunk("str0", strings, &out);
         write_chunk("idx0", vertex_indices, &out);
     }
     
     { // write textures to texture file
-        std::ofstream out(data_path("dist/InknutAntiqua.txtr"), std::ios::binary);
-        write_chunk("txtr", texture_colors, &out);
+        // glyph pages are mostly empty space, so they compress really well
+        uLongf compressed_size = compressBound((uLong) texture_colors.size());
+        std::vector<uint8_t> compressed(compressed_size);
+        if (compress2(compressed.data(), &compressed_size, texture_colors.data(), (uLong) texture_colors.size(),
+                      Z_BEST_COMPRESSION) != Z_OK) {
+            throw std::runtime_error("Problem compressing atlas pages");
+        }
+        compressed.resize(compressed_size);
+        std::cout << "Compressed " << texture_colors.size() << " bytes of atlas pages to " << compressed.size()
+                  << "\n";
+        
+        std::vector<TxtrHeader> header{TxtrHeader{
+                TXTR_VERSION, 1, (uint32_t) texture_colors.size(), sdf ? (float) SDF_SPREAD : 0.0f
+        }};
+        
+        std::ofstream out(out_base + ".txtr", std::ios::binary);
+        write_chunk("txh0", header, &out);
+        write_chunk("txz0", compressed, &out);
+        write_chunk("pag0", pages, &out);
         write_chunk("str0", strings, &out);
-        write_chunk("idx1", texture_indices, &out);
+        write_chunk("idx2", atlas_indices, &out);
     }
     
     std::cout << glyph_count << " glyphs recognized for vertex_indices under " << face->num_glyphs << "\n";
+    std::cout << "Packed into " << pages.size() << " atlas page(s) of " << ATLAS_SIZE << "x" << ATLAS_SIZE << "\n";
     
-    if (FT_Done_Face(face)) {
-        assert(false && "Problem destroying face");
-    }
-    if (FT_Done_FreeType(ft_library)) {
-        assert(false && "Problem destroying library");
-    }
+    close_face(ft_library, face);
 }
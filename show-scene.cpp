@@ -121,6 +121,8 @@ int main(int argc, char **argv) {
                 drawable.pipeline.type = mesh.type;
                 drawable.pipeline.start = mesh.start;
                 drawable.pipeline.count = mesh.count;
+                drawable.min = mesh.min;
+                drawable.max = mesh.max;
                 
             });
         } catch (std::exception &e) {